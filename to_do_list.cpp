@@ -8,203 +8,7965 @@
 #include <stdexcept>
 #include <fstream>
 #include <cstdlib>
+#include <new>
 #include <cassert>
+#include <string_view>
+#include <unordered_map>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <shared_mutex>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <functional>
+#include <filesystem>
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <cctype>
+#include <limits>
+#include <deque>
+#include <exception>
+#include <cmath>
+#include <numeric>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <csignal>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 using namespace std; // Using the entire std namespace for simplicity
 
-// Logging Utility
+// Latency instrumentation. Build with -DTODO_METRICS=0 to compile the timers
+// and histograms out, along with the counting operator new; ScopedTimer then
+// does nothing and the metrics export only carries the logger gauges.
+#ifndef TODO_METRICS
+#define TODO_METRICS 1
+#endif
+
+// Cheap monotonic tick source for timers: the TSC on x86, steady_clock
+// nanoseconds elsewhere. Ticks are converted to nanoseconds only on export,
+// against steady_clock time elapsed since the first export (which waits
+// 10 ms to have a baseline).
+struct CycleClock {
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+
+    static double nanoseconds_per_tick() {
+#if defined(__x86_64__) || defined(__i386__)
+        static const uint64_t start_ticks = now();
+        static const auto start_time = chrono::steady_clock::now();
+        auto elapsed = chrono::steady_clock::now() - start_time;
+        if (elapsed < chrono::milliseconds(10)) {
+            this_thread::sleep_for(chrono::milliseconds(10) - elapsed);
+            elapsed = chrono::steady_clock::now() - start_time;
+        }
+        double ticks = static_cast<double>(now() - start_ticks);
+        return chrono::duration<double, nano>(elapsed).count() / max(ticks, 1.0);
+#else
+        return 1.0;
+#endif
+    }
+};
+
+// Lock-free log-linear latency histogram in the style of HdrHistogram:
+// values below 32 ticks get a bucket each, larger ones 16 buckets per power
+// of two, so any recorded value is reported within 1/16 of its size.
+class LatencyHistogram {
+public:
+    static constexpr size_t bucket_count = 976;
+
+private:
+    array<atomic<uint64_t>, bucket_count> buckets{};
+    atomic<uint64_t> sum{0};
+    atomic<uint64_t> largest{0};
+
+    static size_t bucket_of(uint64_t ticks) {
+        if (ticks < 32) {
+            return static_cast<size_t>(ticks);
+        }
+        int msb = 63 - __builtin_clzll(ticks);
+        return static_cast<size_t>((msb - 3) * 16 + ((ticks >> (msb - 4)) - 16));
+    }
+
+    // Largest value that lands in bucket
+    static uint64_t bucket_limit(size_t bucket) {
+        if (bucket < 32) {
+            return bucket;
+        }
+        int msb = static_cast<int>(bucket / 16) + 3;
+        uint64_t width = uint64_t(1) << (msb - 4);
+        return (bucket % 16 + 16) * width + (width - 1);
+    }
+
+public:
+    void record(uint64_t ticks) {
+        buckets[bucket_of(ticks)].fetch_add(1, memory_order_relaxed);
+        sum.fetch_add(ticks, memory_order_relaxed);
+        uint64_t seen = largest.load(memory_order_relaxed);
+        while (ticks > seen && !largest.compare_exchange_weak(seen, ticks, memory_order_relaxed)) {
+        }
+    }
+
+    // Samples recorded so far; summed over the buckets, so recording pays
+    // for one counter fewer
+    uint64_t count() const {
+        uint64_t recorded = 0;
+        for (const auto& bucket : buckets) {
+            recorded += bucket.load(memory_order_relaxed);
+        }
+        return recorded;
+    }
+
+    uint64_t total_ticks() const {
+        return sum.load(memory_order_relaxed);
+    }
+
+    uint64_t max_ticks() const {
+        return largest.load(memory_order_relaxed);
+    }
+
+    // Smallest bucket limit at or below which a quantile q of the values lie
+    uint64_t quantile_ticks(double q) const {
+        uint64_t recorded = count();
+        if (recorded == 0) {
+            return 0;
+        }
+        uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(q * static_cast<double>(recorded) + 0.5));
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < bucket_count; ++bucket) {
+            seen += buckets[bucket].load(memory_order_relaxed);
+            if (seen >= rank) {
+                return min(bucket_limit(bucket), max_ticks());
+            }
+        }
+        return max_ticks();
+    }
+};
+
+// Process-wide latency histograms, one per instrumented operation
+class Metrics {
+public:
+    enum class Op {
+        Add, Complete, Delete, Undo, Redo, Batch, CompleteMatching,
+        View, Count, Select, Search, Checkpoint, LockWait, JournalCommit, Log,
+        Count_
+    };
+
+    static constexpr size_t op_count = static_cast<size_t>(Op::Count_);
+
+    static const char* op_name(Op op) {
+        static const char* const names[op_count] = {
+            "add", "complete", "delete", "undo", "redo", "batch", "complete_matching",
+            "view", "count", "select", "search", "checkpoint", "lock_wait", "journal_commit", "log"
+        };
+        return names[static_cast<size_t>(op)];
+    }
+
+#if TODO_METRICS
+    static void record(Op op, uint64_t ticks) {
+        histograms()[static_cast<size_t>(op)].record(ticks);
+    }
+
+    static const LatencyHistogram& histogram(Op op) {
+        return histograms()[static_cast<size_t>(op)];
+    }
+
+private:
+    static array<LatencyHistogram, op_count>& histograms() {
+        static array<LatencyHistogram, op_count> all;
+        return all;
+    }
+#else
+    static void record(Op, uint64_t) {}
+#endif
+};
+
+// Record the lifetime of a scope as one sample of an operation's latency
+#if TODO_METRICS
+class ScopedTimer {
+private:
+    Metrics::Op op;
+    uint64_t start;
+
+public:
+    explicit ScopedTimer(Metrics::Op timed) : op(timed), start(CycleClock::now()) {}
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    ~ScopedTimer() {
+        Metrics::record(op, CycleClock::now() - start);
+    }
+};
+#else
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Metrics::Op) {}
+};
+#endif
+
+// Bounded multi-producer/single-consumer ring buffer. Slots keep their value
+// between uses, so producers fill and the consumer drains them in place and a
+// warmed-up queue of strings stops allocating.
+template <typename T>
+class MpscRingBuffer {
+private:
+    struct Slot {
+        atomic<size_t> sequence;
+        T value;
+    };
+
+    unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> enqueue_pos{0};
+    alignas(64) atomic<size_t> dequeue_pos{0};
+
+public:
+    // Create a buffer holding at least capacity entries (rounded up to a power of two)
+    explicit MpscRingBuffer(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots.reset(new Slot[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) {
+            slots[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+
+    // Claim a slot and fill it through fill(T&); returns false when full
+    template <typename Fill>
+    bool try_push(Fill&& fill) {
+        size_t pos = enqueue_pos.load(memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & mask];
+            size_t sequence = slot->sequence.load(memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(memory_order_relaxed);
+            }
+        }
+        fill(slot->value);
+        slot->sequence.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    // Hand the oldest published entry to consume(T&); single consumer only
+    template <typename Consume>
+    bool try_pop(Consume&& consume) {
+        size_t pos = dequeue_pos.load(memory_order_relaxed);
+        Slot& slot = slots[pos & mask];
+        if (slot.sequence.load(memory_order_acquire) != pos + 1) {
+            return false;
+        }
+        consume(slot.value);
+        slot.sequence.store(pos + mask + 1, memory_order_release);
+        dequeue_pos.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    // Number of slots claimed by producers so far
+    size_t claimed() const {
+        return enqueue_pos.load(memory_order_acquire);
+    }
+
+    // Number of entries handed to the consumer so far
+    size_t consumed() const {
+        return dequeue_pos.load(memory_order_acquire);
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+};
+
+// LZ4 compression: the block format, with greedy hash-table matching, and
+// the frame format (independent blocks, each with an xxHash32 checksum),
+// so rotated logs read back with the stock lz4 tool
+class Lz4 {
+private:
+    static constexpr size_t min_match = 4;
+    static constexpr size_t last_literals = 5;      // a block ends in at least this many literals
+    static constexpr size_t match_limit = 12;       // no match starts closer than this to the end
+    static constexpr size_t hash_bits = 12;
+    static constexpr size_t frame_block_size = 64 * 1024;
+    static constexpr uint32_t frame_magic = 0x184D2204;
+
+    static uint32_t read32(const char* in) {
+        uint32_t value;
+        memcpy(&value, in, sizeof(value));
+        return value;
+    }
+
+    static uint32_t rotl(uint32_t value, int bits) {
+        return (value << bits) | (value >> (32 - bits));
+    }
+
+    static char* put_length(char* out, size_t length) {
+        for (; length >= 255; length -= 255) {
+            *out++ = static_cast<char>(255);
+        }
+        *out++ = static_cast<char>(length);
+        return out;
+    }
+
+    static char* put_sequence(char* out, const char* literals, size_t literal_length, size_t offset,
+                              size_t match_length) {
+        char* token = out++;
+        *token = static_cast<char>(min<size_t>(literal_length, 15) << 4);
+        if (literal_length >= 15) {
+            out = put_length(out, literal_length - 15);
+        }
+        memcpy(out, literals, literal_length);
+        out += literal_length;
+        if (match_length == 0) {
+            return out;
+        }
+        *out++ = static_cast<char>(offset & 0xFF);
+        *out++ = static_cast<char>(offset >> 8);
+        *token = static_cast<char>(*token | min<size_t>(match_length - min_match, 15));
+        if (match_length - min_match >= 15) {
+            out = put_length(out, match_length - min_match - 15);
+        }
+        return out;
+    }
+
+public:
+    // Worst-case compressed size of size input bytes
+    static size_t compress_bound(size_t size) {
+        return size + size / 255 + 16;
+    }
+
+    // Compress size bytes into out, which holds compress_bound(size) bytes;
+    // returns the compressed size
+    static size_t compress(const char* in, size_t size, char* out) {
+        char* start = out;
+        size_t anchor = 0;
+        if (size > match_limit) {
+            uint32_t table[size_t(1) << hash_bits] = {};    // position + 1, 0 when empty
+            size_t position = 0;
+            while (position + match_limit <= size) {
+                uint32_t sequence = read32(in + position);
+                uint32_t& entry = table[(sequence * 2654435761u) >> (32 - hash_bits)];
+                size_t candidate = entry;
+                entry = static_cast<uint32_t>(position + 1);
+                if (candidate == 0 || position - (candidate - 1) > 0xFFFF || read32(in + candidate - 1) != sequence) {
+                    position += 1 + ((position - anchor) >> 6);
+                    continue;
+                }
+                size_t match = candidate - 1;
+                size_t length = min_match;
+                while (position + length < size - last_literals && in[match + length] == in[position + length]) {
+                    ++length;
+                }
+                out = put_sequence(out, in + anchor, position - anchor, position - match, length);
+                position += length;
+                anchor = position;
+            }
+        }
+        out = put_sequence(out, in + anchor, size - anchor, 0, 0);
+        return static_cast<size_t>(out - start);
+    }
+
+    // Decompress a block into exactly out_size bytes; false if the block
+    // is malformed or does not decompress to that size
+    static bool decompress(const char* in, size_t size, char* out, size_t out_size) {
+        const char* in_end = in + size;
+        size_t produced = 0;
+        auto get_length = [&](size_t& length) {
+            unsigned char extra;
+            do {
+                if (in == in_end) {
+                    return false;
+                }
+                extra = static_cast<unsigned char>(*in++);
+                length += extra;
+            } while (extra == 255);
+            return true;
+        };
+        while (in < in_end) {
+            unsigned char token = static_cast<unsigned char>(*in++);
+            size_t literal_length = token >> 4;
+            if (literal_length == 15 && !get_length(literal_length)) {
+                return false;
+            }
+            if (literal_length > static_cast<size_t>(in_end - in) || literal_length > out_size - produced) {
+                return false;
+            }
+            memcpy(out + produced, in, literal_length);
+            in += literal_length;
+            produced += literal_length;
+            if (in == in_end) {
+                break;
+            }
+            if (in_end - in < 2) {
+                return false;
+            }
+            size_t offset = static_cast<unsigned char>(in[0]) | static_cast<size_t>(static_cast<unsigned char>(in[1])) << 8;
+            in += 2;
+            size_t match_length = token & 15;
+            if (match_length == 15 && !get_length(match_length)) {
+                return false;
+            }
+            match_length += min_match;
+            if (offset == 0 || offset > produced || match_length > out_size - produced) {
+                return false;
+            }
+            const char* match = out + produced - offset;
+            if (offset >= match_length) {
+                memcpy(out + produced, match, match_length);
+            } else {
+                for (size_t i = 0; i < match_length; ++i) {
+                    out[produced + i] = match[i];
+                }
+            }
+            produced += match_length;
+        }
+        return produced == out_size;
+    }
+
+    // xxHash32, used by the frame format for its checksums
+    static uint32_t xxh32(const char* data, size_t size, uint32_t seed = 0) {
+        const uint32_t prime1 = 2654435761u, prime2 = 2246822519u, prime3 = 3266489917u;
+        const uint32_t prime4 = 668265263u, prime5 = 374761393u;
+        const char* end = data + size;
+        uint32_t hash;
+        if (size >= 16) {
+            uint32_t lanes[4] = {seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+            for (; end - data >= 16; data += 16) {
+                for (int lane = 0; lane < 4; ++lane) {
+                    lanes[lane] = rotl(lanes[lane] + read32(data + 4 * lane) * prime2, 13) * prime1;
+                }
+            }
+            hash = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+        } else {
+            hash = seed + prime5;
+        }
+        hash += static_cast<uint32_t>(size);
+        for (; end - data >= 4; data += 4) {
+            hash = rotl(hash + read32(data) * prime3, 17) * prime4;
+        }
+        for (; data < end; ++data) {
+            hash = rotl(hash + static_cast<unsigned char>(*data) * prime5, 11) * prime1;
+        }
+        hash ^= hash >> 15;
+        hash *= prime2;
+        hash ^= hash >> 13;
+        hash *= prime3;
+        hash ^= hash >> 16;
+        return hash;
+    }
+
+    // Compress the file at source_path into an LZ4 frame at target_path
+    static void compress_file(const string& source_path, const string& target_path) {
+        ifstream in(source_path, ios::binary);
+        ofstream out(target_path, ios::binary | ios::trunc);
+        if (!in || !out) {
+            throw runtime_error("Cannot compress " + source_path + " to " + target_path);
+        }
+        auto put32 = [&out](uint32_t value) {
+            char bytes[4] = {static_cast<char>(value), static_cast<char>(value >> 8),
+                             static_cast<char>(value >> 16), static_cast<char>(value >> 24)};
+            out.write(bytes, sizeof(bytes));
+        };
+        // Version 1, independent blocks with checksums; 64 KB blocks
+        char descriptor[3] = {0x70, 0x40, 0};
+        descriptor[2] = static_cast<char>(xxh32(descriptor, 2) >> 8);
+        put32(frame_magic);
+        out.write(descriptor, sizeof(descriptor));
+        vector<char> block(frame_block_size);
+        vector<char> packed(compress_bound(frame_block_size));
+        while (in.read(block.data(), block.size()) || in.gcount() > 0) {
+            size_t size = static_cast<size_t>(in.gcount());
+            size_t packed_size = compress(block.data(), size, packed.data());
+            bool stored = packed_size >= size;
+            const char* body = stored ? block.data() : packed.data();
+            size_t body_size = stored ? size : packed_size;
+            put32(static_cast<uint32_t>(body_size) | (stored ? 0x80000000u : 0));
+            out.write(body, body_size);
+            put32(xxh32(body, body_size));
+        }
+        put32(0);
+        out.close();
+        if (!out) {
+            throw runtime_error("Cannot write " + target_path);
+        }
+    }
+};
+
+// Log levels, least severe first
+enum class LogLevel : uint8_t {
+    Trace, Debug, Info, Warn, Error, Off
+};
+
+// Calls below this level are compiled out. Build with -DTODO_LOG_MIN_LEVEL=N
+// (0 trace, 1 debug, 2 info, 3 warn, 4 error, 5 off) to raise it.
+#ifndef TODO_LOG_MIN_LEVEL
+#define TODO_LOG_MIN_LEVEL 0
+#endif
+
+constexpr LogLevel compiled_log_level = static_cast<LogLevel>(TODO_LOG_MIN_LEVEL);
+
+inline const char* log_level_name(LogLevel level) {
+    static const char* const names[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "OFF"};
+    return names[static_cast<size_t>(level)];
+}
+
+// Parse a level name (trace, debug, info, warn, error, off)
+inline LogLevel log_level_from_name(string_view name) {
+    static const char* const names[] = {"trace", "debug", "info", "warn", "error", "off"};
+    for (size_t level = 0; level < size(names); ++level) {
+        if (name == names[level]) {
+            return static_cast<LogLevel>(level);
+        }
+    }
+    throw runtime_error("Unknown log level: " + string(name));
+}
+
+// Logging Utility. Messages are written as "[time] LEVEL text", where text
+// is the arguments appended in turn: strings as they are, integers in
+// decimal. The arguments are only formatted, straight into the queue slot,
+// once a message has passed both the compiled and the runtime level.
 class Logger {
 public:
-    // Log message to a file with a timestamp
-    static void log(const string& message) {
-        ofstream logFile("app_log.txt", ios_base::app);
-        if (logFile.is_open()) {
-            logFile << getCurrentTime() << " " << message << endl;
+    // What log() does when the queue is full
+    enum class OverflowPolicy {
+        Block,      // wait for the writer thread to make room
+        DropNewest  // discard the message and count it
+    };
+
+    // How each line is stamped
+    enum class TimestampStyle {
+        Local,      // [2024-03-01 09:30:00] in the local time zone
+        Utc,        // [2024-03-01T09:30:00Z], no time zone conversion
+        Monotonic   // [+12.345678] seconds since the logger started
+    };
+
+    struct Config {
+        string file_path = "app_log.txt";
+        TimestampStyle timestamp_style = TimestampStyle::Local;
+        size_t queue_capacity = 8192;
+        size_t flush_batch_size = 256;               // flush after this many lines
+        chrono::milliseconds flush_interval{100};    // or after this long
+        OverflowPolicy overflow_policy = OverflowPolicy::Block;
+        LogLevel level = LogLevel::Info;             // runtime threshold
+        size_t rotate_bytes = 64 << 20;              // start a new file past this size; 0: never
+        chrono::seconds rotate_interval{0};          // or once the file is this old; 0: never
+        size_t keep_rotated = 8;                     // rotated files kept beside the live one
+        bool compress_rotated = true;                // LZ4-compress rotated files in the background
+    };
+
+    // Replace the logger configuration; pending messages are flushed first.
+    // Not safe to call while other threads are logging.
+    static void configure(const Config& config) {
+        instance().reset();
+        instance().reset(new Logger(config));
+        set_level(config.level);
+    }
+
+    // Change the runtime threshold; safe while other threads are logging
+    static void set_level(LogLevel level) {
+        threshold().store(static_cast<uint8_t>(level), memory_order_relaxed);
+    }
+
+    static LogLevel current_level() {
+        return static_cast<LogLevel>(threshold().load(memory_order_relaxed));
+    }
+
+    // True when a message at level would be written
+    template <LogLevel level>
+    static bool enabled() {
+        if constexpr (level < compiled_log_level || level == LogLevel::Off) {
+            return false;
+        } else {
+            return static_cast<uint8_t>(level) >= threshold().load(memory_order_relaxed);
+        }
+    }
+
+    // Queue a message at level for the background writer. Filtered-out
+    // calls return before touching the arguments.
+    template <LogLevel level, typename... Args>
+    static void log(const Args&... args) {
+        if (enabled<level>()) {
+            ScopedTimer timer(Metrics::Op::Log);
+            instance()->enqueue(level, args...);
+        }
+    }
+
+    template <typename... Args>
+    static void trace(const Args&... args) {
+        log<LogLevel::Trace>(args...);
+    }
+
+    template <typename... Args>
+    static void debug(const Args&... args) {
+        log<LogLevel::Debug>(args...);
+    }
+
+    template <typename... Args>
+    static void info(const Args&... args) {
+        log<LogLevel::Info>(args...);
+    }
+
+    template <typename... Args>
+    static void warn(const Args&... args) {
+        log<LogLevel::Warn>(args...);
+    }
+
+    template <typename... Args>
+    static void error(const Args&... args) {
+        log<LogLevel::Error>(args...);
+    }
+
+    // Log a message at info level
+    static void log(string_view message) {
+        info(message);
+    }
+
+    static void log(string_view message, string_view detail) {
+        info(message, detail);
+    }
+
+    // Block until every message logged so far has been written to the file
+    static void flush() {
+        instance()->flush_pending();
+    }
+
+    // Number of messages discarded under OverflowPolicy::DropNewest
+    static size_t dropped_count() {
+        return instance()->dropped.load(memory_order_relaxed);
+    }
+
+    // Number of messages queued but not yet taken by the writer thread
+    static size_t queue_depth() {
+        const auto& queue = instance()->queue;
+        size_t consumed = queue.consumed();
+        size_t claimed = queue.claimed();
+        return claimed > consumed ? claimed - consumed : 0;
+    }
+
+    static size_t queue_capacity() {
+        return instance()->queue.capacity();
+    }
+
+    ~Logger() {
+        {
+            lock_guard<mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+        if (compressor.joinable()) {
+            {
+                lock_guard<mutex> lock(rotated_mutex);
+                compressor_stopping = true;
+            }
+            rotated_ready.notify_one();
+            compressor.join();
+        }
+    }
+
+private:
+    Config config;
+    MpscRingBuffer<string> queue;
+    atomic<size_t> dropped{0};
+    atomic<size_t> flushed_pos{0};
+    atomic<bool> flush_requested{false};
+    bool stopping = false;
+    mutex wake_mutex;
+    condition_variable wake;
+    condition_variable flushed;
+
+    // Rotated files waiting for the compressor thread
+    mutex rotated_mutex;
+    condition_variable rotated_ready;
+    deque<string> rotated;
+    bool compressor_stopping = false;
+    thread compressor;
+    thread writer;
+
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+
+    explicit Logger(const Config& cfg)
+        : config(cfg), queue(cfg.queue_capacity),
+          compressor(compresses_rotated(cfg) ? thread(&Logger::compress_rotated, this) : thread()),
+          writer(&Logger::run, this) {}
+
+    static bool compresses_rotated(const Config& config) {
+        return config.compress_rotated && (config.rotate_bytes > 0 || config.rotate_interval.count() > 0);
+    }
+
+    static unique_ptr<Logger>& instance() {
+        static unique_ptr<Logger> logger(new Logger(Config()));
+        return logger;
+    }
+
+    static atomic<uint8_t>& threshold() {
+        static atomic<uint8_t> level{static_cast<uint8_t>(Config().level)};
+        return level;
+    }
+
+    static void append(string& line, string_view text) {
+        line += text;
+    }
+
+    static void append(string& line, char c) {
+        line += c;
+    }
+
+    template <typename Integer, typename = enable_if_t<is_integral_v<Integer>>>
+    static void append(string& line, Integer value) {
+        char digits[24];
+        line.append(digits, to_chars(digits, digits + sizeof(digits), value).ptr);
+    }
+
+    template <typename... Args>
+    void enqueue(LogLevel level, const Args&... args) {
+        auto fill = [&](string& line) {
+            line.clear();
+            append_timestamp(line);
+            line += ' ';
+            line += log_level_name(level);
+            line += ' ';
+            (append(line, args), ...);
+        };
+        while (!queue.try_push(fill)) {
+            if (config.overflow_policy == OverflowPolicy::DropNewest) {
+                dropped.fetch_add(1, memory_order_relaxed);
+                return;
+            }
+            wake.notify_one();
+            this_thread::yield();
+        }
+        if (queue.claimed() - queue.consumed() >= config.flush_batch_size) {
+            wake.notify_one();
+        }
+    }
+
+    void flush_pending() {
+        size_t target = queue.claimed();
+        unique_lock<mutex> lock(wake_mutex);
+        flush_requested.store(true, memory_order_release);
+        wake.notify_one();
+        flushed.wait(lock, [&] { return flushed_pos.load(memory_order_acquire) >= target; });
+    }
+
+    // Background writer: drain the queue into a buffered stream, flushing
+    // when a batch fills up, the interval elapses, or a flush is requested
+    void run() {
+        ofstream logFile(config.file_path, ios_base::app);
+        // Only regular files rotate; /dev/null or a pipe is written as is
+        error_code ignored;
+        bool rotating = (config.rotate_bytes > 0 || config.rotate_interval.count() > 0)
+            && filesystem::is_regular_file(config.file_path, ignored);
+        size_t file_size = rotating ? static_cast<size_t>(filesystem::file_size(config.file_path, ignored)) : 0;
+        auto opened = chrono::steady_clock::now();
+        auto rotate = [&] {
             logFile.close();
+            string target = rotated_name();
+            filesystem::rename(config.file_path, target, ignored);
+            logFile.open(config.file_path, ios_base::app);
+            file_size = 0;
+            opened = chrono::steady_clock::now();
+            if (ignored) {
+                return;
+            }
+            if (compresses_rotated(config)) {
+                {
+                    lock_guard<mutex> lock(rotated_mutex);
+                    rotated.push_back(target);
+                }
+                rotated_ready.notify_one();
+            } else {
+                prune_rotated();
+            }
+        };
+        auto write_line = [&](string& line) {
+            if (logFile.is_open()) {
+                logFile.write(line.data(), line.size());
+                logFile.put('\n');
+                file_size += line.size() + 1;
+                if (rotating && config.rotate_bytes > 0 && file_size >= config.rotate_bytes) {
+                    rotate();
+                }
+            }
+        };
+        size_t unflushed = 0;
+        size_t reported_drops = 0;
+        auto last_flush = chrono::steady_clock::now();
+
+        while (true) {
+            while (queue.try_pop(write_line)) {
+                if (++unflushed >= config.flush_batch_size) {
+                    logFile.flush();
+                    unflushed = 0;
+                    last_flush = chrono::steady_clock::now();
+                }
+            }
+
+            size_t drops = dropped.load(memory_order_relaxed);
+            if (drops != reported_drops) {
+                string note;
+                append_timestamp(note);
+                note += " WARN Logger dropped " + to_string(drops - reported_drops) + " messages";
+                write_line(note);
+                reported_drops = drops;
+                ++unflushed;
+            }
+
+            auto now = chrono::steady_clock::now();
+            if (rotating && file_size > 0 && config.rotate_interval.count() > 0
+                && now - opened >= config.rotate_interval) {
+                rotate();
+            }
+            bool flush_now = flush_requested.exchange(false, memory_order_acq_rel);
+            if (unflushed > 0 && (flush_now || now - last_flush >= config.flush_interval)) {
+                logFile.flush();
+                unflushed = 0;
+                last_flush = now;
+            }
+            if (flush_now || unflushed == 0) {
+                {
+                    lock_guard<mutex> lock(wake_mutex);
+                    flushed_pos.store(queue.consumed(), memory_order_release);
+                }
+                flushed.notify_all();
+            }
+
+            unique_lock<mutex> lock(wake_mutex);
+            if (stopping && queue.consumed() == queue.claimed()) {
+                break;
+            }
+            if (!flush_requested.load(memory_order_acquire)) {
+                wake.wait_for(lock, config.flush_interval);
+            }
+        }
+        logFile.flush();
+    }
+
+    // <file>.<UTC date>-<time>-<n>: names sort in rotation order
+    string rotated_name() const {
+        char stamp[32];
+        time_t now = time(nullptr);
+        tm parts;
+#ifdef _WIN32
+        gmtime_s(&parts, &now);
+#else
+        gmtime_r(&now, &parts);
+#endif
+        strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &parts);
+        for (unsigned n = 0;; ++n) {
+            char suffix[8];
+            snprintf(suffix, sizeof(suffix), "-%03u", n);
+            string name = config.file_path + "." + stamp + suffix;
+            if (!filesystem::exists(name) && !filesystem::exists(name + ".lz4")) {
+                return name;
+            }
+        }
+    }
+
+    // Delete the oldest rotated files past keep_rotated
+    void prune_rotated() const {
+        filesystem::path live(config.file_path);
+        string prefix = live.filename().string() + ".";
+        vector<filesystem::path> found;
+        error_code ignored;
+        filesystem::path directory = live.has_parent_path() ? live.parent_path() : filesystem::path(".");
+        for (const auto& entry : filesystem::directory_iterator(directory, ignored)) {
+            string name = entry.path().filename().string();
+            if (name.compare(0, prefix.size(), prefix) == 0 && name.size() > prefix.size() + 15
+                && isdigit(static_cast<unsigned char>(name[prefix.size()]))) {
+                found.push_back(entry.path());
+            }
+        }
+        sort(found.begin(), found.end());
+        for (size_t i = 0; i + config.keep_rotated < found.size(); ++i) {
+            filesystem::remove(found[i], ignored);
+        }
+    }
+
+    // Background compressor: replace each rotated file with <file>.lz4
+    void compress_rotated() {
+        while (true) {
+            string path;
+            {
+                unique_lock<mutex> lock(rotated_mutex);
+                rotated_ready.wait(lock, [&] { return compressor_stopping || !rotated.empty(); });
+                if (rotated.empty()) {
+                    return;
+                }
+                path = move(rotated.front());
+                rotated.pop_front();
+            }
+            try {
+                Lz4::compress_file(path, path + ".lz4.tmp");
+                filesystem::rename(path + ".lz4.tmp", path + ".lz4");
+                filesystem::remove(path);
+            } catch (const exception&) {
+                error_code ignored;
+                filesystem::remove(path + ".lz4.tmp", ignored);    // keep the uncompressed file
+            }
+            prune_rotated();
+        }
+    }
+
+    // Per-thread copy of the last formatted wall-clock stamp
+    struct TimestampCache {
+        time_t second = -1;
+        TimestampStyle style = TimestampStyle::Local;
+        char text[32];
+        size_t length = 0;
+    };
+
+    // Append the current timestamp to line. Wall-clock stamps are formatted
+    // at most once per second per thread; everything else is a memcpy.
+    void append_timestamp(string& line) const {
+        if (config.timestamp_style == TimestampStyle::Monotonic) {
+            auto elapsed = chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - started).count();
+            char buffer[32];
+            char* out = buffer;
+            *out++ = '[';
+            *out++ = '+';
+            out = to_chars(out, buffer + sizeof(buffer), elapsed / 1000000).ptr;
+            *out++ = '.';
+            long long micros = elapsed % 1000000;
+            for (long long scale = 100000; scale > 0; scale /= 10) {
+                *out++ = static_cast<char>('0' + micros / scale % 10);
+            }
+            *out++ = ']';
+            line.append(buffer, out - buffer);
+            return;
+        }
+
+        thread_local TimestampCache cache;
+        time_t now = time(nullptr);
+        if (now != cache.second || config.timestamp_style != cache.style) {
+            tm timeinfo;
+            const char* format;
+            if (config.timestamp_style == TimestampStyle::Utc) {
+#ifdef _WIN32
+                gmtime_s(&timeinfo, &now);
+#else
+                gmtime_r(&now, &timeinfo);
+#endif
+                format = "[%Y-%m-%dT%H:%M:%SZ]";
+            } else {
+#ifdef _WIN32
+                localtime_s(&timeinfo, &now);
+#else
+                localtime_r(&now, &timeinfo);
+#endif
+                format = "[%Y-%m-%d %H:%M:%S]";
+            }
+            cache.length = strftime(cache.text, sizeof(cache.text), format, &timeinfo);
+            cache.second = now;
+            cache.style = config.timestamp_style;
+        }
+        line.append(cache.text, cache.length);
+    }
+};
+
+// Heap allocations made by the process, reported per operation by --bench
+// and in the metrics export. Counting replaces the global operator new and
+// delete, so it is only compiled in with TODO_METRICS; the replacements are
+// kept out of line so callers never see malloc/free.
+atomic<uint64_t> allocation_count{0};
+
+#if TODO_METRICS
+#if defined(__GNUC__) || defined(__clang__)
+#define TODO_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define TODO_NOINLINE __declspec(noinline)
+#else
+#define TODO_NOINLINE
+#endif
+
+// Allocate like the default operator new: retry through the new_handler
+// until it succeeds or there is no handler left, then throw bad_alloc
+inline void* counted_allocate(size_t size, size_t alignment) {
+    allocation_count.fetch_add(1, memory_order_relaxed);
+    size = size ? size : 1;
+    while (true) {
+        void* memory = nullptr;
+        if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            memory = malloc(size);
+        } else {
+#ifdef _WIN32
+            memory = _aligned_malloc(size, alignment);
+#else
+            if (posix_memalign(&memory, max(alignment, sizeof(void*)), size) != 0) {
+                memory = nullptr;
+            }
+#endif
+        }
+        if (memory) {
+            return memory;
+        }
+        new_handler handler = get_new_handler();
+        if (!handler) {
+            throw bad_alloc();
+        }
+        handler();
+    }
+}
+
+inline void counted_free(void* memory, size_t alignment) noexcept {
+#ifdef _WIN32
+    if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        _aligned_free(memory);
+        return;
+    }
+#else
+    (void)alignment;
+#endif
+    free(memory);
+}
+
+TODO_NOINLINE void* operator new(size_t size) {
+    return counted_allocate(size, 0);
+}
+
+TODO_NOINLINE void* operator new(size_t size, align_val_t alignment) {
+    return counted_allocate(size, static_cast<size_t>(alignment));
+}
+
+TODO_NOINLINE void* operator new(size_t size, const nothrow_t&) noexcept {
+    try {
+        return counted_allocate(size, 0);
+    } catch (const bad_alloc&) {
+        return nullptr;
+    }
+}
+
+TODO_NOINLINE void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    try {
+        return counted_allocate(size, static_cast<size_t>(alignment));
+    } catch (const bad_alloc&) {
+        return nullptr;
+    }
+}
+
+TODO_NOINLINE void operator delete(void* memory) noexcept {
+    counted_free(memory, 0);
+}
+
+TODO_NOINLINE void operator delete(void* memory, size_t) noexcept {
+    counted_free(memory, 0);
+}
+
+TODO_NOINLINE void operator delete(void* memory, const nothrow_t&) noexcept {
+    counted_free(memory, 0);
+}
+
+TODO_NOINLINE void operator delete(void* memory, align_val_t alignment) noexcept {
+    counted_free(memory, static_cast<size_t>(alignment));
+}
+
+TODO_NOINLINE void operator delete(void* memory, size_t, align_val_t alignment) noexcept {
+    counted_free(memory, static_cast<size_t>(alignment));
+}
+
+TODO_NOINLINE void operator delete(void* memory, align_val_t alignment, const nothrow_t&) noexcept {
+    counted_free(memory, static_cast<size_t>(alignment));
+}
+#endif
+
+// Write the latency histograms, allocation count and logger queue state in
+// the Prometheus text exposition format
+inline void write_metrics(ostream& out) {
+    char line[192];
+    auto emit = [&](int length) {
+        out.write(line, min<streamsize>(length, sizeof(line) - 1));
+    };
+#if TODO_METRICS
+    double seconds_per_tick = CycleClock::nanoseconds_per_tick() * 1e-9;
+    out << "# HELP todo_operation_duration_seconds Latency of TodoListManager operations and Logger::log\n"
+        << "# TYPE todo_operation_duration_seconds summary\n";
+    for (size_t index = 0; index < Metrics::op_count; ++index) {
+        Metrics::Op op = static_cast<Metrics::Op>(index);
+        const LatencyHistogram& histogram = Metrics::histogram(op);
+        if (histogram.count() == 0) {
+            continue;
+        }
+        for (double q : {0.5, 0.9, 0.99, 0.999}) {
+            emit(snprintf(line, sizeof(line), "todo_operation_duration_seconds{op=\"%s\",quantile=\"%g\"} %.9g\n",
+                Metrics::op_name(op), q, histogram.quantile_ticks(q) * seconds_per_tick));
+        }
+        emit(snprintf(line, sizeof(line), "todo_operation_duration_seconds_sum{op=\"%s\"} %.9g\n",
+            Metrics::op_name(op), histogram.total_ticks() * seconds_per_tick));
+        emit(snprintf(line, sizeof(line), "todo_operation_duration_seconds_count{op=\"%s\"} %llu\n",
+            Metrics::op_name(op), static_cast<unsigned long long>(histogram.count())));
+    }
+    out << "# HELP todo_operation_duration_max_seconds Slowest sample of each operation\n"
+        << "# TYPE todo_operation_duration_max_seconds gauge\n";
+    for (size_t index = 0; index < Metrics::op_count; ++index) {
+        Metrics::Op op = static_cast<Metrics::Op>(index);
+        const LatencyHistogram& histogram = Metrics::histogram(op);
+        if (histogram.count() > 0) {
+            emit(snprintf(line, sizeof(line), "todo_operation_duration_max_seconds{op=\"%s\"} %.9g\n",
+                Metrics::op_name(op), histogram.max_ticks() * seconds_per_tick));
+        }
+    }
+    emit(snprintf(line, sizeof(line),
+        "# HELP todo_heap_allocations_total Heap allocations made by the process\n"
+        "# TYPE todo_heap_allocations_total counter\n"
+        "todo_heap_allocations_total %llu\n",
+        static_cast<unsigned long long>(allocation_count.load(memory_order_relaxed))));
+#endif
+    emit(snprintf(line, sizeof(line),
+        "# HELP todo_logger_queue_depth Log lines queued for the writer thread\n"
+        "# TYPE todo_logger_queue_depth gauge\n"
+        "todo_logger_queue_depth %zu\n", Logger::queue_depth()));
+    emit(snprintf(line, sizeof(line),
+        "# HELP todo_logger_queue_capacity Slots in the log queue\n"
+        "# TYPE todo_logger_queue_capacity gauge\n"
+        "todo_logger_queue_capacity %zu\n", Logger::queue_capacity()));
+    emit(snprintf(line, sizeof(line),
+        "# HELP todo_logger_dropped_total Log lines dropped because the queue was full\n"
+        "# TYPE todo_logger_dropped_total counter\n"
+        "todo_logger_dropped_total %zu\n", Logger::dropped_count()));
+}
+
+// Background thread that rewrites a metrics file every interval, for a
+// Prometheus textfile collector or a person with watch(1). Each dump goes to
+// a temporary file renamed over path, so readers never see a partial one.
+class MetricsDumper {
+private:
+    string path;
+    chrono::milliseconds interval;
+    bool stopping = false;
+    mutex wake_mutex;
+    condition_variable wake;
+    thread dumper;
+
+    void run() {
+        unique_lock<mutex> lock(wake_mutex);
+        while (!stopping) {
+            wake.wait_for(lock, interval, [this] { return stopping; });
+            lock.unlock();
+            dump();
+            lock.lock();
+        }
+    }
+
+    void dump() const {
+        string temporary = path + ".tmp";
+        {
+            ofstream out(temporary, ios::trunc);
+            write_metrics(out);
+            if (!out) {
+                return;
+            }
+        }
+        error_code ignored;
+        filesystem::rename(temporary, path, ignored);
+    }
+
+public:
+    MetricsDumper(string dump_path, chrono::milliseconds dump_interval)
+        : path(move(dump_path)), interval(dump_interval), dumper(&MetricsDumper::run, this) {}
+
+    MetricsDumper(const MetricsDumper&) = delete;
+    MetricsDumper& operator=(const MetricsDumper&) = delete;
+
+    // Stop the thread after one last dump
+    ~MetricsDumper() {
+        {
+            lock_guard<mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        dumper.join();
+    }
+};
+
+// Work-stealing thread pool. Each worker owns a deque: it runs its own work
+// from the back and, when that is empty, steals from the front of the
+// others. parallel_for deals chunks round-robin and the calling thread
+// works alongside the pool until every chunk is done, so nested calls from
+// inside a chunk cannot deadlock. Background jobs from submit run only on
+// workers, after any waiting chunks, so a parallel_for caller never picks
+// one up.
+class ThreadPool {
+private:
+    struct WorkQueue {
+        mutex lock;
+        deque<function<void()>> work;
+    };
+
+    vector<unique_ptr<WorkQueue>> queues;
+    vector<thread> workers;
+    atomic<size_t> queued{0};
+    atomic<size_t> next_queue{0};
+    bool stopping = false;
+    mutex wake_mutex;
+    condition_variable wake;
+    deque<function<void()>> background;     // guarded by wake_mutex
+
+    void push(size_t index, function<void()> job) {
+        {
+            lock_guard<mutex> lock(queues[index]->lock);
+            queues[index]->work.push_back(move(job));
+        }
+        {
+            lock_guard<mutex> lock(wake_mutex);
+            queued.fetch_add(1, memory_order_relaxed);
+        }
+        wake.notify_one();
+    }
+
+    // Run one job: the back of queue home first, then the front of the others
+    bool run_one(size_t home) {
+        function<void()> job;
+        for (size_t i = 0; i < queues.size() && !job; ++i) {
+            WorkQueue& queue = *queues[(home + i) % queues.size()];
+            lock_guard<mutex> lock(queue.lock);
+            if (!queue.work.empty()) {
+                if (i == 0) {
+                    job = move(queue.work.back());
+                    queue.work.pop_back();
+                } else {
+                    job = move(queue.work.front());
+                    queue.work.pop_front();
+                }
+            }
+        }
+        if (!job) {
+            return false;
+        }
+        queued.fetch_sub(1, memory_order_relaxed);
+        job();
+        return true;
+    }
+
+    void run(size_t index) {
+        while (true) {
+            if (run_one(index)) {
+                continue;
+            }
+            unique_lock<mutex> lock(wake_mutex);
+            wake.wait(lock, [&] {
+                return stopping || queued.load(memory_order_relaxed) > 0 || !background.empty();
+            });
+            if (stopping) {
+                return;
+            }
+            if (queued.load(memory_order_relaxed) == 0) {
+                function<void()> job = move(background.front());
+                background.pop_front();
+                lock.unlock();
+                job();
+            }
+        }
+    }
+
+public:
+    // A pool of threads - 1 workers; the caller of parallel_for is the last
+    explicit ThreadPool(size_t threads) {
+        size_t count = max<size_t>(threads, 2) - 1;
+        for (size_t i = 0; i < count; ++i) {
+            queues.push_back(make_unique<WorkQueue>());
+        }
+        for (size_t i = 0; i < count; ++i) {
+            workers.emplace_back([this, i] { run(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Pool sized to the machine, shared by every TodoListManager
+    static ThreadPool& shared() {
+        static ThreadPool pool(max(1u, thread::hardware_concurrency()));
+        return pool;
+    }
+
+    // Run job on a worker without waiting for it; job must not throw
+    void submit(function<void()> job) {
+        {
+            lock_guard<mutex> lock(wake_mutex);
+            background.push_back(move(job));
+        }
+        wake.notify_one();
+    }
+
+    // Threads that can run chunks at once, counting the caller
+    size_t concurrency() const {
+        return workers.size() + 1;
+    }
+
+    // Call body(chunk) for chunk in [0, chunks) and wait for all of them;
+    // the first exception thrown by a chunk is rethrown here
+    template <typename Body>
+    void parallel_for(size_t chunks, Body&& body) {
+        if (chunks <= 1) {
+            if (chunks == 1) {
+                body(size_t(0));
+            }
+            return;
+        }
+        atomic<size_t> remaining{chunks};
+        exception_ptr failure;
+        mutex done_mutex;
+        condition_variable done;
+        size_t first_queue = next_queue.fetch_add(1, memory_order_relaxed);
+        for (size_t chunk = 0; chunk < chunks; ++chunk) {
+            push((first_queue + chunk) % queues.size(), [&, chunk] {
+                try {
+                    body(chunk);
+                } catch (...) {
+                    lock_guard<mutex> lock(done_mutex);
+                    if (!failure) {
+                        failure = current_exception();
+                    }
+                }
+                // The last decrement and its notify happen under done_mutex,
+                // which the caller takes before returning, so this chunk is
+                // done with the caller's locals once it lets go of the lock
+                lock_guard<mutex> lock(done_mutex);
+                if (remaining.fetch_sub(1, memory_order_acq_rel) == 1) {
+                    done.notify_all();
+                }
+            });
+        }
+        while (remaining.load(memory_order_acquire) > 0 && run_one(first_queue % queues.size())) {
+        }
+        unique_lock<mutex> lock(done_mutex);
+        done.wait(lock, [&] { return remaining.load(memory_order_acquire) == 0; });
+        if (failure) {
+            rethrow_exception(failure);
+        }
+    }
+};
+
+// Custom Exception for TaskManager
+class TaskManagerException : public runtime_error {
+public:
+    TaskManagerException(const string& message) : runtime_error(message) {}
+};
+
+// Day numbers: days since 1970-01-01 in the proleptic Gregorian calendar.
+// Out-of-range fields (e.g. day 0) are normalized the way mktime would.
+inline int32_t days_from_civil(int year, int month, int day) {
+    year += (month - 1) / 12;
+    month = (month - 1) % 12 + 1;
+    if (month <= 0) {
+        month += 12;
+        --year;
+    }
+    year -= month <= 2;
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const int year_of_era = year - era * 400;
+    const int day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+inline int32_t to_day_number(const tm& date) {
+    return days_from_civil(date.tm_year + 1900, date.tm_mon + 1, date.tm_mday);
+}
+
+inline tm from_day_number(int32_t days) {
+    days += 719468;
+    const int era = (days >= 0 ? days : days - 146096) / 146097;
+    const int day_of_era = days - era * 146097;
+    const int year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    const int day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    const int month_index = (5 * day_of_year + 2) / 153;
+    const int month = month_index < 10 ? month_index + 3 : month_index - 9;
+    tm date = {};
+    date.tm_year = year_of_era + era * 400 + (month <= 2) - 1900;
+    date.tm_mon = month - 1;
+    date.tm_mday = day_of_year - (153 * month_index + 2) / 5 + 1;
+    return date;
+}
+
+// Today's day number in the local time zone
+inline int32_t today_day_number() {
+    time_t now = time(nullptr);
+    tm local;
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    return to_day_number(local);
+}
+
+// Parse a "YYYY MM DD" date (fields separated by blanks) from the front of
+// text into a day number, consuming it and the blanks after it. Returns
+// false, leaving text as it was, if the date is malformed or does not exist.
+inline bool parse_date(string_view& text, int32_t& day_number) {
+    auto is_blank = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+    const char* cursor = text.data();
+    const char* end = text.data() + text.size();
+    int fields[3];
+    for (int& field : fields) {
+        while (cursor < end && is_blank(*cursor)) {
+            ++cursor;
+        }
+        auto result = from_chars(cursor, end, field);
+        if (result.ec != errc() || (result.ptr < end && !is_blank(*result.ptr))) {
+            return false;
+        }
+        cursor = result.ptr;
+    }
+    if (fields[1] < 1 || fields[1] > 12 || fields[2] < 1 || fields[2] > 31) {
+        return false;
+    }
+    int32_t day = days_from_civil(fields[0], fields[1], fields[2]);
+    tm check = from_day_number(day);
+    if (check.tm_mon + 1 != fields[1] || check.tm_mday != fields[2]) {
+        return false;
+    }
+    while (cursor < end && is_blank(*cursor)) {
+        ++cursor;
+    }
+    text.remove_prefix(static_cast<size_t>(cursor - text.data()));
+    day_number = day;
+    return true;
+}
+
+// Append a number in decimal, without locale lookups
+inline void append_decimal(string& out, long long value) {
+    char digits[24];
+    auto result = to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr - digits);
+}
+
+// Append one "description - Status, Due: Y-M-D" task line
+inline void append_task_line(string& out, string_view description, bool completed, const tm& due_date) {
+    out += description;
+    out += completed ? " - Completed, Due: " : " - Pending, Due: ";
+    append_decimal(out, due_date.tm_year + 1900);
+    out += '-';
+    append_decimal(out, due_date.tm_mon + 1);
+    out += '-';
+    append_decimal(out, due_date.tm_mday);
+    out += '\n';
+}
+
+// Print one task line in the format shared by Task and TaskView. The line
+// is written in one call and not flushed; cin's tie flushes before input.
+inline void print_task(string_view description, bool completed, const tm& due_date) {
+    thread_local string line;
+    line.clear();
+    append_task_line(line, description, completed, due_date);
+    cout.write(line.data(), static_cast<streamsize>(line.size()));
+}
+
+class TaskMemento {
+public:
+    string description;
+    bool completed;
+    tm due_date;
+
+    TaskMemento(const string& desc, bool comp, const tm& date)
+        : description(desc), completed(comp), due_date(date) {}
+};
+
+class Task {
+public:
+    string description;
+    bool completed;
+    tm due_date;
+
+    Task() : completed(false), due_date() {}
+
+    Task(const string& desc) : description(desc), completed(false), due_date() {}
+
+    // Mark the task as completed
+    void mark_completed() {
+        completed = true;
+    }
+
+    // Undo the task to a previous state using a memento
+    void undo(const TaskMemento& memento) {
+        description = memento.description;
+        completed = memento.completed;
+        due_date = memento.due_date;
+    }
+
+    // Create a memento representing the current state of the task
+    TaskMemento create_memento() const {
+        return TaskMemento(description, completed, due_date);
+    }
+
+    // Print the task details
+    void print() const {
+        print_task(description, completed, due_date);
+    }
+};
+
+// Builds the Task passed to add_task, which copies it into the store, so
+// the task itself is never kept. Reset and reuse one builder to add in a
+// loop: its description keeps its capacity and adds stop allocating.
+class TaskBuilder {
+private:
+    Task task;
+
+public:
+    TaskBuilder() = default;
+
+    // Initialize the task builder with a description
+    TaskBuilder(string_view desc) {
+        reset(desc);
+    }
+
+    // Start a new task: pending, with no due date
+    TaskBuilder& reset(string_view desc) {
+        task.description.assign(desc.data(), desc.size());
+        task.completed = false;
+        task.due_date = tm();
+        return *this;
+    }
+
+    // Set the due date for the task
+    TaskBuilder& set_due_date(const tm& date) {
+        task.due_date = date;
+        return *this;
+    }
+
+    TaskBuilder& set_completed(bool completed) {
+        task.completed = completed;
+        return *this;
+    }
+
+    // The built task; valid until the builder is reset or destroyed
+    const Task& build() const {
+        return task;
+    }
+};
+
+// Stable identifier of a stored task; never reused
+using TaskId = uint32_t;
+
+// Append-only storage for description bytes. Blocks are never moved or freed,
+// so views handed out stay valid for the arena's lifetime.
+class StringArena {
+private:
+    static constexpr size_t block_size = 64 * 1024;
+    vector<unique_ptr<char[]>> blocks;
+    vector<unique_ptr<char[]>> large_blocks;
+    vector<shared_ptr<const void>> retained;
+    size_t used = block_size;
+
+public:
+    // Keep externally owned bytes (e.g. a mapped snapshot) alive with the arena
+    void retain(shared_ptr<const void> backing) {
+        retained.push_back(move(backing));
+    }
+
+    // Copy text into the arena and return a view of the copy
+    string_view store(string_view text) {
+        if (text.empty()) {
+            return string_view();
+        }
+        char* out;
+        if (text.size() > block_size / 4) {
+            large_blocks.emplace_back(new char[text.size()]);
+            out = large_blocks.back().get();
+        } else {
+            if (used + text.size() > block_size) {
+                blocks.emplace_back(new char[block_size]);
+                used = 0;
+            }
+            out = blocks.back().get() + used;
+            used += text.size();
+        }
+        memcpy(out, text.data(), text.size());
+        return string_view(out, text.size());
+    }
+};
+
+// Handle of an interned description; 0 is the empty description
+using DescriptionId = uint32_t;
+
+// Interned task descriptions. Each distinct text is stored once in a
+// monotonic arena and named by a 32-bit handle, so duplicate descriptions
+// and undo/redo copies cost no extra bytes. Texts are never released.
+class DescriptionPool {
+public:
+    static constexpr DescriptionId none = UINT32_MAX;
+
+private:
+    StringArena arena;
+    vector<string_view> texts{string_view()};
+    unordered_map<string_view, DescriptionId> handles;
+
+    DescriptionId add_text(string_view stored) {
+        DescriptionId id = static_cast<DescriptionId>(texts.size());
+        texts.push_back(stored);
+        handles.emplace(stored, id);
+        return id;
+    }
+
+public:
+    // Keep externally owned bytes (e.g. a mapped snapshot) alive with the pool
+    void retain(shared_ptr<const void> backing) {
+        arena.retain(move(backing));
+    }
+
+    // Handle for text, copying it into the arena the first time it is seen
+    DescriptionId intern(string_view text) {
+        DescriptionId id = find(text);
+        return id != none ? id : add_text(arena.store(text));
+    }
+
+    // Handle for text that already outlives the pool (see retain); no copy
+    DescriptionId adopt(string_view text) {
+        DescriptionId id = find(text);
+        return id != none ? id : add_text(text);
+    }
+
+    // Handle for text if it has been interned, none otherwise
+    DescriptionId find(string_view text) const {
+        if (text.empty()) {
+            return 0;
+        }
+        auto it = handles.find(text);
+        return it == handles.end() ? none : it->second;
+    }
+
+    string_view text(DescriptionId id) const {
+        return texts[id];
+    }
+
+    // Number of handles issued, including the empty description
+    size_t size() const {
+        return texts.size();
+    }
+
+    void reserve(size_t count) {
+        texts.reserve(count + 1);
+        handles.reserve(count);
+    }
+};
+
+// Flush a file's contents to stable storage
+inline void sync_file(const string& path) {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0 || fsync(fd) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw TaskManagerException("Cannot sync " + path);
+    }
+    ::close(fd);
+#else
+    (void)path;
+#endif
+}
+
+// Make a rename into path's directory durable
+inline void sync_parent_directory(const string& path) {
+#ifndef _WIN32
+    string directory = filesystem::path(path).parent_path().string();
+    int fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+#else
+    (void)path;
+#endif
+}
+
+// Read-only view of a whole file, memory-mapped where the platform allows
+class MappedFile {
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    vector<char> buffer;
+#endif
+
+public:
+    explicit MappedFile(const string& path) {
+#ifdef _WIN32
+        ifstream file(path, ios::binary);
+        if (!file) {
+            throw TaskManagerException("Cannot open " + path);
+        }
+        buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        bytes = buffer.data();
+        length = buffer.size();
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw TaskManagerException("Cannot open " + path);
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw TaskManagerException("Cannot stat " + path);
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length > 0) {
+            void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                ::close(fd);
+                throw TaskManagerException("Cannot map " + path);
+            }
+            bytes = static_cast<const char*>(mapping);
+        }
+        ::close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (bytes) {
+            munmap(const_cast<char*>(bytes), length);
+        }
+#endif
+    }
+
+    const char* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
+
+// Dense struct-of-arrays task storage. Each column is indexed by slot (the
+// task's position in list order): ids, packed completed and live bitsets,
+// due dates as day numbers and interned description handles. Status and
+// date scans touch only the column they need. Deleting clears a live bit;
+// the dead rows are compacted away in bulk once they make up a quarter of
+// the store.
+class TaskStore {
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+private:
+    vector<TaskId> ids;
+    vector<uint64_t> completed_bits;
+    vector<int32_t> due_days;
+    vector<DescriptionId> descriptions;
+    vector<uint64_t> live_bits;
+    vector<uint32_t> slot_of_id;
+    size_t dead = 0;
+    size_t unordered_from = SIZE_MAX;     // rows from here were reinserted out of list order
+    DescriptionPool pool;
+
+public:
+    // Replace all tasks with columns loaded from a snapshot; handles name
+    // texts in the given pool. The columns are checked before any is
+    // replaced, so a corrupt snapshot leaves the store as it was.
+    void restore(size_t count, TaskId next_id, const TaskId* task_ids, const uint64_t* words,
+                 const int32_t* days, vector<DescriptionId> task_descriptions,
+                 DescriptionPool description_pool) {
+        if (task_descriptions.size() != count) {
+            throw TaskManagerException("Corrupt snapshot: description count mismatch");
+        }
+        vector<uint32_t> slots(next_id, npos);
+        for (size_t slot = 0; slot < count; ++slot) {
+            if (task_ids[slot] >= next_id || slots[task_ids[slot]] != npos) {
+                throw TaskManagerException("Corrupt snapshot: task id out of range or repeated");
+            }
+            slots[task_ids[slot]] = static_cast<uint32_t>(slot);
+        }
+        ids.assign(task_ids, task_ids + count);
+        completed_bits.assign(words, words + (count + 63) / 64);
+        due_days.assign(days, days + count);
+        descriptions = move(task_descriptions);
+        pool = move(description_pool);
+        live_bits.assign((count + 63) / 64, ~uint64_t(0));
+        if (count % 64 != 0) {
+            live_bits.back() = (uint64_t(1) << (count % 64)) - 1;
+        }
+        dead = 0;
+        unordered_from = SIZE_MAX;
+        slot_of_id = move(slots);
+    }
+
+    // Id the next added task will get
+    TaskId next_id() const {
+        return static_cast<TaskId>(slot_of_id.size());
+    }
+
+    // Append a task and return its new id
+    TaskId add(string_view description, bool completed, int32_t due_day) {
+        TaskId id = static_cast<TaskId>(slot_of_id.size());
+        uint32_t slot = static_cast<uint32_t>(ids.size());
+        slot_of_id.push_back(slot);
+        ids.push_back(id);
+        due_days.push_back(due_day);
+        descriptions.push_back(pool.intern(description));
+        if (slot % 64 == 0) {
+            completed_bits.push_back(0);
+            live_bits.push_back(0);
+        }
+        set_completed(slot, completed);
+        live_bits[slot / 64] |= uint64_t(1) << (slot % 64);
+        return id;
+    }
+
+    // Number of live tasks
+    size_t size() const {
+        return ids.size() - dead;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // Number of slots, live or tombstoned; scans run over [0, slot_count())
+    size_t slot_count() const {
+        return ids.size();
+    }
+
+    // Number of tombstoned slots awaiting compaction
+    size_t dead_count() const {
+        return dead;
+    }
+
+    void reserve(size_t count) {
+        ids.reserve(count);
+        due_days.reserve(count);
+        descriptions.reserve(count);
+        completed_bits.reserve((count + 63) / 64);
+        live_bits.reserve((count + 63) / 64);
+    }
+
+    // Slot currently holding live task id, or npos if the task was removed
+    uint32_t slot(TaskId id) const {
+        uint32_t slot = id < slot_of_id.size() ? slot_of_id[id] : npos;
+        return slot != npos && live_at(slot) ? slot : npos;
+    }
+
+    TaskId id_at(uint32_t slot) const {
+        return ids[slot];
+    }
+
+    bool live_at(uint32_t slot) const {
+        return (live_bits[slot / 64] >> (slot % 64)) & 1;
+    }
+
+    bool completed_at(uint32_t slot) const {
+        return (completed_bits[slot / 64] >> (slot % 64)) & 1;
+    }
+
+    int32_t due_day_at(uint32_t slot) const {
+        return due_days[slot];
+    }
+
+    string_view description_at(uint32_t slot) const {
+        return pool.text(descriptions[slot]);
+    }
+
+    DescriptionId description_id_at(uint32_t slot) const {
+        return descriptions[slot];
+    }
+
+    string_view description_text(DescriptionId description) const {
+        return pool.text(description);
+    }
+
+    // Handle of an already interned description, or DescriptionPool::none
+    DescriptionId find_description(string_view description) const {
+        return pool.find(description);
+    }
+
+    // Number of description handles issued so far
+    size_t description_count() const {
+        return pool.size();
+    }
+
+    // Raw columns for scan kernels, indexed by slot. Only slots with their
+    // live bit set hold tasks; bits past slot_count() are always zero.
+    const vector<uint64_t>& completed_words() const {
+        return completed_bits;
+    }
+
+    const vector<uint64_t>& live_words() const {
+        return live_bits;
+    }
+
+    const vector<int32_t>& due_day_column() const {
+        return due_days;
+    }
+
+    const vector<TaskId>& id_column() const {
+        return ids;
+    }
+
+    // Call visit(slot) for every live slot in list order
+    template <typename Visitor>
+    void for_each_live_slot(Visitor&& visit) const {
+        for (size_t word = 0; word < live_bits.size(); ++word) {
+            for (uint64_t bits = live_bits[word]; bits; bits &= bits - 1) {
+                visit(static_cast<uint32_t>(word * 64 + __builtin_ctzll(bits)));
+            }
+        }
+    }
+
+    void set_completed(uint32_t slot, bool completed) {
+        uint64_t bit = uint64_t(1) << (slot % 64);
+        if (completed) {
+            completed_bits[slot / 64] |= bit;
+        } else {
+            completed_bits[slot / 64] &= ~bit;
+        }
+    }
+
+    void set_due_day(uint32_t slot, int32_t due_day) {
+        due_days[slot] = due_day;
+    }
+
+    // Intern a description so it can be kept as a handle
+    DescriptionId intern_description(string_view description) {
+        return pool.intern(description);
+    }
+
+    // Replace a description; the old text stays in the pool
+    void set_description(uint32_t slot, string_view description) {
+        descriptions[slot] = pool.intern(description);
+    }
+
+    // Tombstone the task at slot in O(1). The row stays in place, so undo
+    // can revive it, until enough rows are dead to compact the columns.
+    void erase(uint32_t slot) {
+        live_bits[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+        ++dead;
+        if (dead >= compaction_min_dead && dead * compaction_dead_ratio >= ids.size()) {
+            compact();
+        }
+    }
+
+    // Put a removed task back under its old id. A tombstoned row is revived
+    // in place in O(1). A compacted-away row is appended in O(1), out of
+    // list order, until restore_order merges it back; callers reviving
+    // several rows call restore_order once after the last.
+    void insert(TaskId id, DescriptionId description, bool completed, int32_t due_day) {
+        uint32_t slot = slot_of_id[id];
+        if (slot == npos) {
+            slot = static_cast<uint32_t>(ids.size());
+            unordered_from = min(unordered_from, ids.size());
+            slot_of_id[id] = slot;
+            ids.push_back(id);
+            due_days.push_back(due_day);
+            descriptions.push_back(description);
+            if (slot % 64 == 0) {
+                completed_bits.push_back(0);
+                live_bits.push_back(0);
+            }
+        } else {
+            --dead;
+            due_days[slot] = due_day;
+            descriptions[slot] = description;
+        }
+        set_completed(slot, completed);
+        live_bits[slot / 64] |= uint64_t(1) << (slot % 64);
+    }
+
+    // Merge rows appended by insert back into id order, which is list
+    // order. This moves every row from the first one out of place, so it is
+    // O(n) once per batch of revived rows instead of once per row.
+    void restore_order() {
+        if (unordered_from == SIZE_MAX) {
+            return;
+        }
+        size_t count = ids.size();
+        vector<uint32_t> appended(count - unordered_from);
+        iota(appended.begin(), appended.end(), static_cast<uint32_t>(unordered_from));
+        auto by_id = [this](uint32_t left, uint32_t right) { return ids[left] < ids[right]; };
+        sort(appended.begin(), appended.end(), by_id);
+        vector<uint32_t> order;
+        order.reserve(count);
+        uint32_t next = 0;
+        for (uint32_t slot : appended) {
+            while (next < unordered_from && by_id(next, slot)) {
+                order.push_back(next++);
+            }
+            order.push_back(slot);
+        }
+        while (next < unordered_from) {
+            order.push_back(next++);
+        }
+        unordered_from = SIZE_MAX;
+        size_t first = 0;
+        while (first < count && order[first] == first) {
+            ++first;
+        }
+        if (first == count) {
+            return;
+        }
+        vector<TaskId> moved_ids(count - first);
+        vector<int32_t> moved_days(count - first);
+        vector<DescriptionId> moved_descriptions(count - first);
+        vector<uint8_t> moved_flags(count - first);
+        for (size_t slot = first; slot < count; ++slot) {
+            uint32_t from = order[slot];
+            moved_ids[slot - first] = ids[from];
+            moved_days[slot - first] = due_days[from];
+            moved_descriptions[slot - first] = descriptions[from];
+            moved_flags[slot - first] = static_cast<uint8_t>(completed_at(from) | (live_at(from) << 1));
+        }
+        for (size_t slot = first; slot < count; ++slot) {
+            uint32_t to = static_cast<uint32_t>(slot);
+            uint8_t flags = moved_flags[slot - first];
+            ids[slot] = moved_ids[slot - first];
+            due_days[slot] = moved_days[slot - first];
+            descriptions[slot] = moved_descriptions[slot - first];
+            set_completed(to, flags & 1);
+            uint64_t bit = uint64_t(1) << (slot % 64);
+            live_bits[slot / 64] = (flags & 2) ? live_bits[slot / 64] | bit : live_bits[slot / 64] & ~bit;
+            slot_of_id[ids[slot]] = to;
+        }
+    }
+
+    // Drop every tombstoned row, keeping live rows in list order
+    void compact() {
+        restore_order();
+        size_t kept = 0;
+        for (size_t slot = 0; slot < ids.size(); ++slot) {
+            uint32_t from = static_cast<uint32_t>(slot);
+            if (!live_at(from)) {
+                slot_of_id[ids[slot]] = npos;
+                continue;
+            }
+            bool completed = completed_at(from);
+            ids[kept] = ids[slot];
+            due_days[kept] = due_days[slot];
+            descriptions[kept] = descriptions[slot];
+            slot_of_id[ids[kept]] = static_cast<uint32_t>(kept);
+            set_completed(static_cast<uint32_t>(kept), completed);
+            ++kept;
+        }
+        ids.resize(kept);
+        due_days.resize(kept);
+        descriptions.resize(kept);
+        size_t words = (kept + 63) / 64;
+        completed_bits.resize(words);
+        live_bits.assign(words, ~uint64_t(0));
+        if (kept % 64 != 0) {
+            uint64_t tail = (uint64_t(1) << (kept % 64)) - 1;
+            completed_bits.back() &= tail;
+            live_bits.back() = tail;
+        }
+        dead = 0;
+    }
+
+private:
+    static constexpr size_t compaction_min_dead = 1024;
+    static constexpr size_t compaction_dead_ratio = 4;   // compact once 1/4 of rows are dead
+};
+
+// Read-only view of a stored task with the same accessors as Task
+class TaskView {
+private:
+    const TaskStore* store;
+    uint32_t slot;
+
+public:
+    TaskView(const TaskStore& tasks, uint32_t task_slot) : store(&tasks), slot(task_slot) {}
+
+    TaskId id() const {
+        return store->id_at(slot);
+    }
+
+    string_view description() const {
+        return store->description_at(slot);
+    }
+
+    bool completed() const {
+        return store->completed_at(slot);
+    }
+
+    int32_t due_day() const {
+        return store->due_day_at(slot);
+    }
+
+    tm due_date() const {
+        return from_day_number(due_day());
+    }
+
+    // Create a memento representing the current state of the task
+    TaskMemento create_memento() const {
+        return TaskMemento(string(description()), completed(), due_date());
+    }
+
+    // Print the task details
+    void print() const {
+        print_task(description(), completed(), due_date());
+    }
+};
+
+// Output formats for task listings
+enum class OutputFormat { Text, Csv, JsonLines };
+
+// Parse an output format name: text, csv or jsonl
+inline OutputFormat output_format_from_name(const string& name) {
+    if (name == "text") {
+        return OutputFormat::Text;
+    }
+    if (name == "csv") {
+        return OutputFormat::Csv;
+    }
+    if (name == "jsonl") {
+        return OutputFormat::JsonLines;
+    }
+    throw TaskManagerException("Unknown output format " + name);
+}
+
+// Formats tasks into a reusable buffer and hands it to the stream in large
+// writes, with no per-task flush or locale lookups. Text matches
+// TaskView::print; CSV starts with a header row (id, description, status,
+// due); JSON lines hold one object per task. Dates are YYYY-MM-DD in CSV
+// and JSON.
+class TaskWriter {
+private:
+    static constexpr size_t flush_bytes = 64 * 1024;
+    ostream& out;
+    OutputFormat format;
+    string buffer;
+
+    void append_padded(int value, int width) {
+        char digits[12];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        for (int length = static_cast<int>(result.ptr - digits); length < width; ++length) {
+            buffer += '0';
+        }
+        buffer.append(digits, result.ptr - digits);
+    }
+
+    void append_date(const tm& date) {
+        append_padded(date.tm_year + 1900, 4);
+        buffer += '-';
+        append_padded(date.tm_mon + 1, 2);
+        buffer += '-';
+        append_padded(date.tm_mday, 2);
+    }
+
+    // RFC 4180: quote fields holding separators, quotes or line breaks
+    void append_csv_field(string_view text) {
+        if (text.find_first_of(",\"\r\n") == string_view::npos) {
+            buffer += text;
+            return;
+        }
+        buffer += '"';
+        for (char c : text) {
+            if (c == '"') {
+                buffer += '"';
+            }
+            buffer += c;
+        }
+        buffer += '"';
+    }
+
+    void append_json_string(string_view text) {
+        static const char hex[] = "0123456789abcdef";
+        buffer += '"';
+        for (char c : text) {
+            unsigned char byte = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\') {
+                buffer += '\\';
+                buffer += c;
+            } else if (byte < 0x20) {
+                buffer += "\\u00";
+                buffer += hex[byte >> 4];
+                buffer += hex[byte & 0xf];
+            } else {
+                buffer += c;
+            }
+        }
+        buffer += '"';
+    }
+
+public:
+    TaskWriter(ostream& stream, OutputFormat output_format) : out(stream), format(output_format) {
+        buffer.reserve(flush_bytes + 4096);
+        if (format == OutputFormat::Csv) {
+            buffer += "id,description,status,due\n";
+        }
+    }
+
+    TaskWriter(const TaskWriter&) = delete;
+    TaskWriter& operator=(const TaskWriter&) = delete;
+
+    ~TaskWriter() {
+        flush();
+    }
+
+    void write(const TaskView& task) {
+        tm due_date = task.due_date();
+        switch (format) {
+            case OutputFormat::Text:
+                append_task_line(buffer, task.description(), task.completed(), due_date);
+                break;
+            case OutputFormat::Csv:
+                append_decimal(buffer, task.id());
+                buffer += ',';
+                append_csv_field(task.description());
+                buffer += task.completed() ? ",completed," : ",pending,";
+                append_date(due_date);
+                buffer += '\n';
+                break;
+            case OutputFormat::JsonLines:
+                buffer += "{\"id\":";
+                append_decimal(buffer, task.id());
+                buffer += ",\"description\":";
+                append_json_string(task.description());
+                buffer += task.completed() ? ",\"completed\":true,\"due\":\"" : ",\"completed\":false,\"due\":\"";
+                append_date(due_date);
+                buffer += "\"}\n";
+                break;
+        }
+        if (buffer.size() >= flush_bytes) {
+            flush();
+        }
+    }
+
+    // Hand everything formatted so far to the stream
+    void flush() {
+        out.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+        buffer.clear();
+    }
+};
+
+// Index of the lowest set bit; bits must be non-zero
+inline unsigned lowest_set_bit(uint64_t bits) {
+    return static_cast<unsigned>(__builtin_ctzll(bits));
+}
+
+// Due-range filter kernels: bit i of the result is set when days[i] lies in
+// [first, last], for count <= 64 days. The vector kernels handle full
+// 64-task words and leave partial words to the scalar loop.
+inline uint64_t due_range_mask_scalar(const int32_t* days, size_t count, int32_t first, int32_t last) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < count; ++i) {
+        mask |= uint64_t(days[i] >= first && days[i] <= last) << i;
+    }
+    return mask;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+__attribute__((target("avx2")))
+inline uint64_t due_range_mask_avx2(const int32_t* days, size_t count, int32_t first, int32_t last) {
+    if (count < 64) {
+        return due_range_mask_scalar(days, count, first, last);
+    }
+    const __m256i first_day = _mm256_set1_epi32(first);
+    const __m256i last_day = _mm256_set1_epi32(last);
+    uint64_t mask = 0;
+    for (size_t i = 0; i < 64; i += 8) {
+        __m256i day = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(days + i));
+        __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi32(first_day, day), _mm256_cmpgt_epi32(day, last_day));
+        uint32_t out = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(outside)));
+        mask |= uint64_t(~out & 0xff) << i;
+    }
+    return mask;
+}
+#elif defined(__aarch64__)
+inline uint64_t due_range_mask_neon(const int32_t* days, size_t count, int32_t first, int32_t last) {
+    if (count < 64) {
+        return due_range_mask_scalar(days, count, first, last);
+    }
+    const int32x4_t first_day = vdupq_n_s32(first);
+    const int32x4_t last_day = vdupq_n_s32(last);
+    static const uint32_t lane_bits[4] = {1, 2, 4, 8};
+    const uint32x4_t lanes = vld1q_u32(lane_bits);
+    uint64_t mask = 0;
+    for (size_t i = 0; i < 64; i += 4) {
+        int32x4_t day = vld1q_s32(days + i);
+        uint32x4_t inside = vandq_u32(vcgeq_s32(day, first_day), vcleq_s32(day, last_day));
+        mask |= uint64_t(vaddvq_u32(vandq_u32(inside, lanes))) << i;
+    }
+    return mask;
+}
+#endif
+
+using DueRangeKernel = uint64_t (*)(const int32_t*, size_t, int32_t, int32_t);
+
+// Widest due-range kernel this CPU runs
+inline DueRangeKernel best_due_range_kernel() {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return due_range_mask_avx2;
+    }
+#elif defined(__aarch64__)
+    return due_range_mask_neon;
+#endif
+    return due_range_mask_scalar;
+}
+
+inline const char* due_range_kernel_name(DueRangeKernel kernel) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    if (kernel == due_range_mask_avx2) {
+        return "avx2";
+    }
+#elif defined(__aarch64__)
+    if (kernel == due_range_mask_neon) {
+        return "neon";
+    }
+#endif
+    return "scalar";
+}
+
+// Kernel used by TaskFilter, picked once at startup; the benchmark swaps it
+// (before any other thread runs) to compare implementations
+inline DueRangeKernel due_range_mask = best_due_range_kernel();
+
+// Composable predicate over stored tasks: completion status, an inclusive
+// due-day range and a description prefix. A default filter matches all tasks.
+// The prefix is viewed, not copied, so it must outlive the filter.
+class TaskFilter {
+public:
+    enum class Status { Any, Completed, Pending };
+
+private:
+    Status wanted_status = Status::Any;
+    int32_t first_due_day = INT32_MIN;
+    int32_t last_due_day = INT32_MAX;
+    string_view prefix;
+
+public:
+    // Build the filter for a view_tasks menu option (all, completed,
+    // pending, overdue)
+    static TaskFilter from_option(const string& filter_option) {
+        TaskFilter filter;
+        if (filter_option == "completed") {
+            filter.status(Status::Completed);
+        } else if (filter_option == "pending") {
+            filter.status(Status::Pending);
+        } else if (filter_option == "overdue") {
+            filter.status(Status::Pending).due_before(today_day_number());
+        }
+        return filter;
+    }
+
+    // True when the filter bounds the due date, so the due-date index applies
+    bool has_due_range() const {
+        return first_due_day != INT32_MIN || last_due_day != INT32_MAX;
+    }
+
+    int32_t first_day() const {
+        return first_due_day;
+    }
+
+    int32_t last_day() const {
+        return last_due_day;
+    }
+
+    TaskFilter& status(Status status) {
+        wanted_status = status;
+        return *this;
+    }
+
+    // Keep tasks due on or between the two day numbers
+    TaskFilter& due_between(int32_t first_day, int32_t last_day) {
+        first_due_day = max(first_due_day, first_day);
+        last_due_day = min(last_due_day, last_day);
+        return *this;
+    }
+
+    // Keep tasks due strictly before the day number
+    TaskFilter& due_before(int32_t day) {
+        return due_between(INT32_MIN, day == INT32_MIN ? day : day - 1);
+    }
+
+    TaskFilter& description_prefix(string_view text) {
+        prefix = text;
+        return *this;
+    }
+
+    // Check the non-status predicates for one slot
+    bool matches_fields(const TaskStore& tasks, uint32_t slot) const {
+        int32_t due_day = tasks.due_day_at(slot);
+        if (due_day < first_due_day || due_day > last_due_day) {
+            return false;
+        }
+        return prefix.empty() || tasks.description_at(slot).substr(0, prefix.size()) == prefix;
+    }
+
+    bool matches(const TaskStore& tasks, uint32_t slot) const {
+        if (wanted_status != Status::Any && tasks.completed_at(slot) != (wanted_status == Status::Completed)) {
+            return false;
+        }
+        return matches_fields(tasks, slot);
+    }
+
+    // Selection mask for the 64 slots of one bitset word: status and due
+    // range, leaving only the description prefix to check per task
+    uint64_t word_mask(const TaskStore& tasks, size_t word) const {
+        uint64_t bits = tasks.live_words()[word];
+        if (wanted_status == Status::Pending) {
+            bits &= ~tasks.completed_words()[word];
+        } else if (wanted_status == Status::Completed) {
+            bits &= tasks.completed_words()[word];
+        }
+        size_t remaining = min<size_t>(tasks.slot_count() - word * 64, 64);
+        if (bits && has_due_range()) {
+            bits &= due_range_mask(tasks.due_day_column().data() + word * 64, remaining,
+                first_due_day, last_due_day);
+        }
+        return bits;
+    }
+
+    // Number of 64-task words a scan covers; scans can be split by word
+    static size_t word_count(const TaskStore& tasks) {
+        return tasks.completed_words().size();
+    }
+
+    // Call visit(slot) for each matching slot in words [first_word,
+    // last_word), in list order. Status and due range are resolved 64 tasks
+    // at a time; nothing is allocated.
+    template <typename Visitor>
+    void for_each_slot(const TaskStore& tasks, size_t first_word, size_t last_word, Visitor&& visit) const {
+        for (size_t word = first_word; word < last_word; ++word) {
+            uint64_t bits = word_mask(tasks, word);
+            while (bits) {
+                uint32_t slot = static_cast<uint32_t>(word * 64 + lowest_set_bit(bits));
+                bits &= bits - 1;
+                if (prefix.empty() || tasks.description_at(slot).substr(0, prefix.size()) == prefix) {
+                    visit(slot);
+                }
+            }
+        }
+    }
+
+    template <typename Visitor>
+    void for_each_slot(const TaskStore& tasks, Visitor&& visit) const {
+        for_each_slot(tasks, 0, word_count(tasks), visit);
+    }
+
+    // Call visit(TaskView) for each matching task in list order
+    template <typename Visitor>
+    void for_each(const TaskStore& tasks, Visitor&& visit) const {
+        for_each_slot(tasks, [&](uint32_t slot) { visit(TaskView(tasks, slot)); });
+    }
+
+    // Append the slots of matching tasks, in list order, to selection
+    void select(const TaskStore& tasks, vector<uint32_t>& selection) const {
+        for_each_slot(tasks, [&selection](uint32_t slot) { selection.push_back(slot); });
+    }
+
+    // Number of matching tasks in words [first_word, last_word); without a
+    // prefix this is a popcount per word
+    size_t count(const TaskStore& tasks, size_t first_word, size_t last_word) const {
+        size_t total = 0;
+        if (!prefix.empty()) {
+            for_each_slot(tasks, first_word, last_word, [&total](uint32_t) { ++total; });
+            return total;
+        }
+        for (size_t word = first_word; word < last_word; ++word) {
+            total += static_cast<size_t>(__builtin_popcountll(word_mask(tasks, word)));
+        }
+        return total;
+    }
+
+    size_t count(const TaskStore& tasks) const {
+        return count(tasks, 0, word_count(tasks));
+    }
+
+    // Serialize as uint8_t status, int32_t first and last due day and the
+    // prefix bytes, for journal records
+    string encode() const {
+        string out;
+        uint8_t status_byte = static_cast<uint8_t>(wanted_status);
+        out.append(reinterpret_cast<const char*>(&status_byte), sizeof(status_byte));
+        out.append(reinterpret_cast<const char*>(&first_due_day), sizeof(first_due_day));
+        out.append(reinterpret_cast<const char*>(&last_due_day), sizeof(last_due_day));
+        out.append(prefix.data(), prefix.size());
+        return out;
+    }
+
+    // Rebuild an encoded filter; its prefix views the payload bytes
+    static TaskFilter decode(string_view payload) {
+        const size_t fixed = sizeof(uint8_t) + 2 * sizeof(int32_t);
+        if (payload.size() < fixed || static_cast<uint8_t>(payload[0]) > 2) {
+            throw TaskManagerException("Corrupt filter record");
+        }
+        TaskFilter filter;
+        filter.wanted_status = static_cast<Status>(payload[0]);
+        memcpy(&filter.first_due_day, payload.data() + 1, sizeof(filter.first_due_day));
+        memcpy(&filter.last_due_day, payload.data() + 5, sizeof(filter.last_due_day));
+        filter.prefix = payload.substr(fixed);
+        return filter;
+    }
+};
+
+// One reversible step of undo/redo history, keyed by task id. A change
+// carries the task's row only while that row is out of the store (a
+// delete on the undo log, an add on the redo log), so most steps are just
+// an id. Descriptions are pool handles, so a change is 20 bytes.
+struct TaskChange {
+    enum class Kind : uint8_t { Add = 1, Complete = 2, Delete = 3 };
+
+    Kind kind;
+    bool unit_start = false;    // first change of an undoable unit (e.g. a batch)
+    bool completed = false;
+    TaskId id;
+    uint32_t slot = 0;          // list position the row occupied when removed
+    int32_t due_day = 0;
+    DescriptionId description = 0;
+
+    static TaskChange of(Kind kind, TaskId id) {
+        TaskChange change;
+        change.kind = kind;
+        change.id = id;
+        return change;
+    }
+};
+
+// Index of task ids keyed by description handle; duplicate descriptions
+// share a bucket kept in list order. Keys are integers, so a lookup hashes
+// the text once (in the pool) and never allocates.
+class DescriptionIndex {
+private:
+    unordered_map<DescriptionId, vector<TaskId>> buckets;
+
+public:
+    // Index a task under its description handle
+    void insert(DescriptionId description, TaskId id) {
+        buckets[description].push_back(id);
+    }
+
+    // Index a task that may sit before others with the same description;
+    // list order is id order, so the bucket stays sorted by id
+    void insert_ordered(DescriptionId description, TaskId id) {
+        auto& bucket = buckets[description];
+        bucket.insert(lower_bound(bucket.begin(), bucket.end(), id), id);
+    }
+
+    // Remove a task indexed under description
+    void erase(DescriptionId description, TaskId id) {
+        auto it = buckets.find(description);
+        if (it == buckets.end()) {
+            return;
+        }
+        auto& bucket = it->second;
+        bucket.erase(remove(bucket.begin(), bucket.end(), id), bucket.end());
+        if (bucket.empty()) {
+            buckets.erase(it);
+        }
+    }
+
+    // Find the first indexed task with the given description accepted by pred
+    template <typename Predicate>
+    TaskId find(DescriptionId description, Predicate pred) const {
+        auto it = buckets.find(description);
+        if (it == buckets.end()) {
+            return TaskStore::npos;
+        }
+        for (TaskId id : it->second) {
+            if (pred(id)) {
+                return id;
+            }
+        }
+        return TaskStore::npos;
+    }
+
+    void reserve(size_t count) {
+        buckets.reserve(count);
+    }
+
+    void clear() {
+        buckets.clear();
+    }
+};
+
+// Sorted task ids stored as blocks of delta-encoded varints. Each block
+// keeps its first and last id uncompressed, so a seek skips whole blocks and
+// an insert or erase re-encodes only one block. Ids mostly arrive in
+// increasing order, which appends to the last block.
+class PostingList {
+public:
+    struct Block {
+        TaskId first;
+        TaskId last;
+        uint32_t count;
+        vector<uint8_t> deltas;     // varint gaps after first
+    };
+
+    static constexpr uint32_t block_limit = 128;
+
+private:
+    vector<Block> blocks;
+    size_t total = 0;
+
+    static void append_varint(vector<uint8_t>& out, uint32_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    static Block encode(const TaskId* ids, size_t count) {
+        Block block{ids[0], ids[count - 1], static_cast<uint32_t>(count), {}};
+        block.deltas.reserve(count);
+        for (size_t i = 1; i < count; ++i) {
+            append_varint(block.deltas, ids[i] - ids[i - 1]);
+        }
+        return block;
+    }
+
+    // First block whose last id is at least id (blocks.size() if none)
+    size_t block_for(TaskId id) const {
+        return lower_bound(blocks.begin(), blocks.end(), id,
+            [](const Block& block, TaskId value) { return block.last < value; }) - blocks.begin();
+    }
+
+public:
+    // Decode a block's ids into out, replacing its contents
+    static void decode(const Block& block, vector<TaskId>& out) {
+        out.resize(block.count);
+        out[0] = block.first;
+        const uint8_t* in = block.deltas.data();
+        for (uint32_t i = 1; i < block.count; ++i) {
+            uint32_t gap = 0;
+            int shift = 0;
+            uint8_t byte;
+            do {
+                byte = *in++;
+                gap |= uint32_t(byte & 0x7f) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+            out[i] = out[i - 1] + gap;
+        }
+    }
+
+    void insert(TaskId id) {
+        ++total;
+        if (blocks.empty() || (id > blocks.back().last && blocks.back().count < block_limit)) {
+            if (blocks.empty()) {
+                blocks.push_back({id, id, 1, {}});
+            } else {
+                Block& tail = blocks.back();
+                append_varint(tail.deltas, id - tail.last);
+                tail.last = id;
+                ++tail.count;
+            }
+            return;
+        }
+        if (id > blocks.back().last) {
+            blocks.push_back({id, id, 1, {}});
+            return;
+        }
+        size_t index = block_for(id);
+        vector<TaskId> ids;
+        decode(blocks[index], ids);
+        auto position = lower_bound(ids.begin(), ids.end(), id);
+        if (position != ids.end() && *position == id) {
+            --total;
+            return;
+        }
+        ids.insert(position, id);
+        if (ids.size() > block_limit) {
+            size_t half = ids.size() / 2;
+            blocks[index] = encode(ids.data(), half);
+            blocks.insert(blocks.begin() + index + 1, encode(ids.data() + half, ids.size() - half));
+        } else {
+            blocks[index] = encode(ids.data(), ids.size());
+        }
+    }
+
+    void erase(TaskId id) {
+        size_t index = block_for(id);
+        if (index == blocks.size() || blocks[index].first > id) {
+            return;
+        }
+        vector<TaskId> ids;
+        decode(blocks[index], ids);
+        auto position = lower_bound(ids.begin(), ids.end(), id);
+        if (position == ids.end() || *position != id) {
+            return;
+        }
+        --total;
+        ids.erase(position);
+        if (ids.empty()) {
+            blocks.erase(blocks.begin() + index);
+        } else {
+            blocks[index] = encode(ids.data(), ids.size());
+        }
+    }
+
+    size_t size() const {
+        return total;
+    }
+
+    bool empty() const {
+        return total == 0;
+    }
+
+    size_t block_count() const {
+        return blocks.size();
+    }
+
+    const Block& block(size_t index) const {
+        return blocks[index];
+    }
+
+    // First block at or after from whose last id is at least target, found
+    // by galloping: probe from+1, +2, +4, ... then binary search the gap
+    size_t seek_block(size_t from, TaskId target) const {
+        if (from >= blocks.size() || blocks[from].last >= target) {
+            return from;
+        }
+        size_t low = from;
+        size_t step = 1;
+        while (low + step < blocks.size() && blocks[low + step].last < target) {
+            low += step;
+            step *= 2;
+        }
+        size_t high = min(low + step, blocks.size());
+        return lower_bound(blocks.begin() + low + 1, blocks.begin() + high, target,
+            [](const Block& block, TaskId value) { return block.last < value; }) - blocks.begin();
+    }
+};
+
+// Inverted index from lower-cased description words to posting lists of
+// task ids. Words are runs of ASCII letters and digits; other bytes of 0x80
+// and up also count as word characters so UTF-8 text tokenizes by spaces and
+// punctuation. Words are kept sorted so a prefix names a contiguous range.
+class SearchIndex {
+private:
+    map<string, PostingList, less<>> postings;
+
+    static bool word_char(unsigned char c) {
+        return isalnum(c) || c >= 0x80;
+    }
+
+    // Reads ids from one posting list, decoding only the blocks a seek lands
+    // on, or the union of several such cursors merged through a min-heap of
+    // their current ids
+    class Cursor {
+    private:
+        const PostingList* list = nullptr;
+        vector<TaskId> ids;
+        size_t block = 0;
+        size_t position = 0;
+        vector<Cursor> parts;
+        vector<uint32_t> heap;      // indexes of unfinished parts, smallest id on top
+        size_t total = 0;
+
+        bool after(uint32_t left, uint32_t right) const {
+            return parts[left].value() > parts[right].value();
+        }
+
+        // Restore the heap after the top part moved forward
+        void sift_down() {
+            size_t at = 0;
+            while (true) {
+                size_t child = 2 * at + 1;
+                if (child >= heap.size()) {
+                    return;
+                }
+                if (child + 1 < heap.size() && after(heap[child], heap[child + 1])) {
+                    ++child;
+                }
+                if (!after(heap[at], heap[child])) {
+                    return;
+                }
+                swap(heap[at], heap[child]);
+                at = child;
+            }
+        }
+
+        void load(size_t index) {
+            block = index;
+            position = 0;
+            if (block < list->block_count()) {
+                PostingList::decode(list->block(block), ids);
+            } else {
+                ids.clear();
+            }
+        }
+
+    public:
+        explicit Cursor(const PostingList& posting_list) : list(&posting_list) {
+            load(0);
+        }
+
+        // Union of lists, each read by its own cursor
+        explicit Cursor(const vector<const PostingList*>& lists) {
+            parts.reserve(lists.size());
+            for (const PostingList* posting_list : lists) {
+                parts.emplace_back(*posting_list);
+                total += posting_list->size();
+            }
+            for (uint32_t part = 0; part < parts.size(); ++part) {
+                heap.push_back(part);
+            }
+            auto order = [this](uint32_t left, uint32_t right) { return after(left, right); };
+            make_heap(heap.begin(), heap.end(), order);
+        }
+
+        bool done() const {
+            return list ? position >= ids.size() : heap.empty();
+        }
+
+        TaskId value() const {
+            return list ? ids[position] : parts[heap.front()].value();
+        }
+
+        // Upper bound on the ids left to visit, to order the intersection
+        size_t cost() const {
+            return list ? list->size() : total;
+        }
+
+        // Move to the first id at least target. A union re-seeks only the
+        // parts that are behind, so each part gallops over what it skips.
+        void seek(TaskId target) {
+            if (!list) {
+                while (!heap.empty() && parts[heap.front()].value() < target) {
+                    Cursor& part = parts[heap.front()];
+                    part.seek(target);
+                    if (part.done()) {
+                        heap.front() = heap.back();
+                        heap.pop_back();
+                    }
+                    sift_down();
+                }
+                return;
+            }
+            if (!done() && ids.back() < target) {
+                size_t next = list->seek_block(block + 1, target);
+                if (next >= list->block_count()) {
+                    position = ids.size();
+                    return;
+                }
+                load(next);
+            }
+            position = lower_bound(ids.begin() + position, ids.end(), target) - ids.begin();
+        }
+    };
+
+public:
+    // Split text into lower-cased words, each reported once. The words view
+    // a per-thread buffer that is reused, so tokenizing stops allocating
+    // once warm; visit must not tokenize again.
+    template <typename Visitor>
+    static void for_each_word(string_view text, Visitor&& visit) {
+        thread_local string lowered;
+        thread_local vector<string_view> words;
+        lowered.resize(text.size());
+        for (size_t i = 0; i < text.size(); ++i) {
+            lowered[i] = static_cast<char>(tolower(static_cast<unsigned char>(text[i])));
+        }
+        words.clear();
+        size_t index = 0;
+        while (index < lowered.size()) {
+            while (index < lowered.size() && !word_char(static_cast<unsigned char>(lowered[index]))) {
+                ++index;
+            }
+            size_t start = index;
+            while (index < lowered.size() && word_char(static_cast<unsigned char>(lowered[index]))) {
+                ++index;
+            }
+            if (index > start) {
+                words.push_back(string_view(lowered).substr(start, index - start));
+            }
+        }
+        sort(words.begin(), words.end());
+        words.erase(unique(words.begin(), words.end()), words.end());
+        for (string_view word : words) {
+            visit(word);
+        }
+    }
+
+    void insert(string_view description, TaskId id) {
+        for_each_word(description, [&](string_view word) {
+            auto it = postings.find(word);
+            if (it == postings.end()) {
+                it = postings.emplace(string(word), PostingList()).first;
+            }
+            it->second.insert(id);
+        });
+    }
+
+    void erase(string_view description, TaskId id) {
+        for_each_word(description, [&](string_view word) {
+            auto it = postings.find(word);
+            if (it != postings.end()) {
+                it->second.erase(id);
+                if (it->second.empty()) {
+                    postings.erase(it);
+                }
+            }
+        });
+    }
+
+    void clear() {
+        postings.clear();
+    }
+
+    // Call visit(id), in id order, for tasks whose description contains
+    // every query word. A word ending in '*' matches any word it prefixes.
+    // Lists are intersected smallest first with galloping seeks.
+    template <typename Visitor>
+    size_t search(string_view query, Visitor&& visit) const {
+        vector<Cursor> cursors;
+        size_t start = 0;
+        while (start < query.size()) {
+            size_t end = query.find(' ', start);
+            if (end == string_view::npos) {
+                end = query.size();
+            }
+            string_view term = query.substr(start, end - start);
+            start = end + 1;
+            bool prefix = !term.empty() && term.back() == '*';
+            if (prefix) {
+                term.remove_suffix(1);
+            }
+            bool missing = false;
+            for_each_word(term, [&](string_view word) {
+                if (!prefix) {
+                    auto it = postings.find(word);
+                    if (it == postings.end()) {
+                        missing = true;
+                    } else {
+                        cursors.emplace_back(it->second);
+                    }
+                    return;
+                }
+                vector<const PostingList*> lists;
+                for (auto it = postings.lower_bound(word);
+                     it != postings.end() && it->first.compare(0, word.size(), word) == 0; ++it) {
+                    lists.push_back(&it->second);
+                }
+                if (lists.size() == 1) {
+                    cursors.emplace_back(*lists[0]);
+                } else if (!lists.empty()) {
+                    cursors.emplace_back(lists);
+                }
+                missing = missing || lists.empty();
+            });
+            // A word that is not indexed matches nothing
+            if (missing) {
+                return 0;
+            }
+        }
+        if (cursors.empty()) {
+            return 0;
+        }
+        sort(cursors.begin(), cursors.end(),
+            [](const Cursor& left, const Cursor& right) { return left.cost() < right.cost(); });
+
+        size_t found = 0;
+        Cursor& lead = cursors[0];
+        while (!lead.done()) {
+            TaskId candidate = lead.value();
+            bool all = true;
+            for (size_t i = 1; i < cursors.size(); ++i) {
+                cursors[i].seek(candidate);
+                if (cursors[i].done()) {
+                    return found;
+                }
+                if (cursors[i].value() != candidate) {
+                    candidate = cursors[i].value();
+                    all = false;
+                    break;
+                }
+            }
+            if (all) {
+                visit(candidate);
+                ++found;
+                lead.seek(candidate + 1);
+            } else {
+                lead.seek(candidate);
+            }
+        }
+        return found;
+    }
+};
+
+// CRC-32 (IEEE 802.3) used to detect torn or corrupt journal records
+inline uint32_t crc32(const char* data, size_t size, uint32_t crc = 0) {
+    static const auto table = [] {
+        array<uint32_t, 256> entries{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+            }
+            entries[i] = value;
+        }
+        return entries;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Operations recorded in the journal
+enum class JournalOp : uint8_t {
+    Add = 1,
+    Complete = 2,
+    Delete = 3,
+    Undo = 4,   // description holds the reverted changes (see encode_changes)
+    Redo = 5,   // description holds the re-applied changes
+    Batch = 6,  // description holds the commands encoded by encode_batch
+    CompleteMatching = 7,   // description holds a TaskFilter::encode filter
+    Pipeline = 8            // as Batch, but each command is its own undo step
+};
+
+// One command of a batch passed to TodoListManager::apply_batch. The
+// description is viewed, so it must outlive the call.
+struct TaskCommand {
+    enum class Kind : uint8_t { Add = 1, Complete = 2, Delete = 3 };
+
+    Kind kind;
+    string_view description;
+    int32_t due_day = 0;
+
+    static TaskCommand add(string_view description, const tm& due_date) {
+        return TaskCommand{Kind::Add, description, to_day_number(due_date)};
+    }
+
+    static TaskCommand complete(string_view description) {
+        return TaskCommand{Kind::Complete, description, 0};
+    }
+
+    static TaskCommand remove(string_view description) {
+        return TaskCommand{Kind::Delete, description, 0};
+    }
+};
+
+// Outcome counts of an apply_batch call
+struct BatchResult {
+    size_t added = 0;
+    size_t completed = 0;
+    size_t deleted = 0;
+    size_t failed = 0;
+};
+
+// Encode commands as a sequence of (uint8_t kind, int32_t due_day,
+// uint32_t length, description bytes) for a single Batch journal record
+inline string encode_batch(const TaskCommand* commands, size_t count) {
+    string out;
+    for (size_t i = 0; i < count; ++i) {
+        const TaskCommand& command = commands[i];
+        uint8_t kind = static_cast<uint8_t>(command.kind);
+        uint32_t length = static_cast<uint32_t>(command.description.size());
+        out.append(reinterpret_cast<const char*>(&kind), sizeof(kind));
+        out.append(reinterpret_cast<const char*>(&command.due_day), sizeof(command.due_day));
+        out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.append(command.description.data(), command.description.size());
+    }
+    return out;
+}
+
+// Decode an encode_batch payload; descriptions view the payload bytes
+inline vector<TaskCommand> decode_batch(string_view payload) {
+    vector<TaskCommand> commands;
+    const size_t prefix = sizeof(uint8_t) + sizeof(int32_t) + sizeof(uint32_t);
+    size_t offset = 0;
+    while (payload.size() - offset >= prefix) {
+        TaskCommand command;
+        uint8_t kind;
+        uint32_t length;
+        memcpy(&kind, payload.data() + offset, sizeof(kind));
+        memcpy(&command.due_day, payload.data() + offset + 1, sizeof(command.due_day));
+        memcpy(&length, payload.data() + offset + 5, sizeof(length));
+        offset += prefix;
+        if (length > payload.size() - offset) {
+            throw TaskManagerException("Corrupt batch record");
+        }
+        command.kind = static_cast<TaskCommand::Kind>(kind);
+        command.description = payload.substr(offset, length);
+        offset += length;
+        commands.push_back(command);
+    }
+    return commands;
+}
+
+// One decoded journal record; description views the journal's bytes
+struct JournalRecord {
+    uint64_t sequence;
+    JournalOp op;
+    string_view description;
+    int32_t due_day;
+    bool completed;
+};
+
+// Append-only write-ahead log of TodoListManager operations. Each record is
+//   uint32_t body_length, uint32_t crc32(body), body
+// where body is uint64_t sequence, uint8_t op, int32_t due_day,
+// uint8_t completed and the description bytes. Callers append a record and
+// then commit it; the first committer writes and syncs everything buffered
+// so far, so one fsync covers every operation that queued up meanwhile.
+//
+// The journal doubles as a change feed: each synced group of records is
+// also kept in memory, up to feed_bytes, for read_feed to hand out by
+// sequence number. Subscribers are called whenever new records are synced.
+class OperationJournal {
+public:
+    struct Options {
+        bool sync = true;                                // fsync on commit
+        chrono::microseconds group_commit_window{0};     // wait to gather more commits
+        uint64_t checkpoint_bytes = 64 * 1024 * 1024;    // checkpoint past this size
+        size_t feed_bytes = 16 * 1024 * 1024;            // synced records kept for the change feed
+    };
+
+    static constexpr size_t record_header_size = 8;
+
+private:
+    static constexpr char magic[8] = {'T', 'O', 'D', 'O', 'J', 'R', 'N', 'L'};
+    static constexpr size_t header_size = 16;
+    static constexpr size_t body_prefix_size = 14;
+
+    // Records synced together, as written to the file
+    struct FeedSegment {
+        uint64_t first_sequence;
+        uint64_t last_sequence;
+        string records;
+    };
+
+    string path;
+    Options options;
+    FILE* file = nullptr;
+    mutex journal_mutex;
+    condition_variable synced;
+    string buffer;
+    string batch;
+    uint64_t last_sequence;
+    uint64_t durable_sequence;
+    atomic<uint64_t> file_bytes{0};
+    bool syncing = false;
+    atomic<bool> failed{false};      // a write or sync failed; nothing after durable_sequence is safe
+    string failure;
+
+    mutable mutex feed_mutex;
+    deque<FeedSegment> feed;
+    size_t feed_size = 0;
+    uint64_t feed_last_sequence;
+    map<size_t, function<void()>> subscribers;
+    size_t next_subscriber = 0;
+
+    template <typename T>
+    static void put(string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    static T get(const char* in) {
+        T value;
+        memcpy(&value, in, sizeof(value));
+        return value;
+    }
+
+    void open_file(const char* mode) {
+        file = fopen(path.c_str(), mode);
+        if (!file) {
+            throw TaskManagerException("Cannot open journal " + path);
+        }
+        fseek(file, 0, SEEK_END);
+        file_bytes = static_cast<uint64_t>(ftell(file));
+        if (file_bytes == 0) {
+            string header(magic, sizeof(magic));
+            put<uint32_t>(header, 1);
+            put<uint32_t>(header, 0);
+            write_and_sync(header);
+        }
+    }
+
+    void write_and_sync(const string& bytes) {
+        if (fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size() || fflush(file) != 0) {
+            throw TaskManagerException("Cannot write journal " + path);
+        }
+        if (options.sync) {
+#ifdef _WIN32
+            bool sync_failed = _commit(_fileno(file)) != 0;
+#else
+            bool sync_failed = fdatasync(fileno(file)) != 0;
+#endif
+            if (sync_failed) {
+                throw TaskManagerException("Cannot sync journal " + path + ": " + strerror(errno));
+            }
+        }
+        file_bytes += bytes.size();
+    }
+
+    // Keep a synced group of records for the change feed and wake the
+    // subscribers; the oldest groups are dropped past feed_bytes
+    void publish(uint64_t first_sequence, uint64_t last_sequence, const string& records) {
+        lock_guard<mutex> lock(feed_mutex);
+        if (options.feed_bytes > 0) {
+            feed.push_back(FeedSegment{first_sequence, last_sequence, records});
+            feed_size += records.size();
+            while (feed.size() > 1 && feed_size > options.feed_bytes) {
+                feed_size -= feed.front().records.size();
+                feed.pop_front();
+            }
+        }
+        feed_last_sequence = last_sequence;
+        for (auto& subscriber : subscribers) {
+            subscriber.second();
+        }
+    }
+
+public:
+    // Open path for appending; sequence numbers continue after last_applied
+    OperationJournal(const string& journal_path, uint64_t last_applied, const Options& journal_options)
+        : path(journal_path), options(journal_options), last_sequence(last_applied),
+          durable_sequence(last_applied), feed_last_sequence(last_applied) {
+        open_file("ab");
+    }
+
+    OperationJournal(const OperationJournal&) = delete;
+    OperationJournal& operator=(const OperationJournal&) = delete;
+
+    ~OperationJournal() {
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    const Options& config() const {
+        return options;
+    }
+
+    uint64_t size_bytes() const {
+        return file_bytes;
+    }
+
+    // True once a write or sync has failed: every commit of a record not
+    // yet durable throws until a checkpoint resets the journal
+    bool has_failed() const {
+        return failed.load(memory_order_acquire);
+    }
+
+    // Append one encoded record to out
+    static void encode_record(string& out, uint64_t sequence, JournalOp op, string_view description,
+                              int32_t due_day, bool completed) {
+        size_t start = out.size();
+        put<uint32_t>(out, static_cast<uint32_t>(body_prefix_size + description.size()));
+        put<uint32_t>(out, 0);
+        put<uint64_t>(out, sequence);
+        put<uint8_t>(out, static_cast<uint8_t>(op));
+        put<int32_t>(out, due_day);
+        put<uint8_t>(out, completed ? 1 : 0);
+        out.append(description.data(), description.size());
+        const char* body = out.data() + start + record_header_size;
+        uint32_t checksum = crc32(body, out.size() - start - record_header_size);
+        memcpy(&out[start + 4], &checksum, sizeof(checksum));
+    }
+
+    // Decode the record at the front of data into record, whose description
+    // views data. Returns the record's size, or 0 if data holds no complete,
+    // intact record.
+    static size_t decode_record(const char* data, size_t size, JournalRecord& record) {
+        if (size < record_header_size) {
+            return 0;
+        }
+        uint32_t body_length = get<uint32_t>(data);
+        uint32_t checksum = get<uint32_t>(data + 4);
+        const char* body = data + record_header_size;
+        if (body_length < body_prefix_size || body_length > size - record_header_size
+            || crc32(body, body_length) != checksum) {
+            return 0;
+        }
+        record.sequence = get<uint64_t>(body);
+        record.op = static_cast<JournalOp>(get<uint8_t>(body + 8));
+        record.due_day = get<int32_t>(body + 9);
+        record.completed = get<uint8_t>(body + 13) != 0;
+        record.description = string_view(body + body_prefix_size, body_length - body_prefix_size);
+        return record_header_size + body_length;
+    }
+
+    // Buffer a record and return its sequence number
+    uint64_t append(JournalOp op, string_view description = {}, int32_t due_day = 0, bool completed = false) {
+        lock_guard<mutex> lock(journal_mutex);
+        uint64_t sequence = ++last_sequence;
+        encode_record(buffer, sequence, op, description, due_day, completed);
+        return sequence;
+    }
+
+    // Block until the record with this sequence number is durable; throws
+    // if it cannot be made durable
+    void commit(uint64_t sequence) {
+        unique_lock<mutex> lock(journal_mutex);
+        while (durable_sequence < sequence) {
+            if (failed) {
+                throw TaskManagerException(failure + "; changes after sequence "
+                    + to_string(durable_sequence) + " are not durable");
+            }
+            if (syncing) {
+                synced.wait(lock);
+                continue;
+            }
+            syncing = true;
+            if (options.group_commit_window.count() > 0) {
+                lock.unlock();
+                this_thread::sleep_for(options.group_commit_window);
+                lock.lock();
+            }
+            batch.swap(buffer);
+            uint64_t batch_first = durable_sequence + 1;
+            uint64_t batch_last = last_sequence;
+            lock.unlock();
+            bool written = true;
+            string error;
+            try {
+                write_and_sync(batch);
+            } catch (const exception& e) {
+                written = false;
+                error = e.what();
+            }
+            if (written && !batch.empty()) {
+                publish(batch_first, batch_last, batch);
+            }
+            batch.clear();
+            lock.lock();
+            syncing = false;
+            if (written) {
+                durable_sequence = batch_last;
+            } else {
+                failure = error;
+                failed = true;
+            }
+            synced.notify_all();
+        }
+    }
+
+    // Append to out the synced records after after_sequence, as written to
+    // the file, stopping before out grows past max_bytes (but always taking
+    // at least one record). last is set to the sequence of the last record
+    // taken. Returns false if records after after_sequence have already been
+    // dropped from memory, or were never synced here; read a snapshot then.
+    bool read_feed(uint64_t after_sequence, string& out, size_t max_bytes, uint64_t& last) const {
+        lock_guard<mutex> lock(feed_mutex);
+        last = after_sequence;
+        if (after_sequence >= feed_last_sequence) {
+            return after_sequence == feed_last_sequence;
+        }
+        if (feed.empty() || feed.front().first_sequence > after_sequence + 1) {
+            return false;
+        }
+        auto segment = partition_point(feed.begin(), feed.end(),
+            [&](const FeedSegment& candidate) { return candidate.last_sequence <= after_sequence; });
+        size_t taken = 0;
+        for (; segment != feed.end(); ++segment) {
+            const string& records = segment->records;
+            size_t offset = 0;
+            for (uint64_t skip = segment->first_sequence; skip <= last; ++skip) {
+                offset += record_header_size + get<uint32_t>(records.data() + offset);
+            }
+            if (taken + records.size() - offset <= max_bytes) {
+                out.append(records, offset, string::npos);
+                taken += records.size() - offset;
+                last = segment->last_sequence;
+                continue;
+            }
+            while (offset < records.size()) {
+                size_t record_size = record_header_size + get<uint32_t>(records.data() + offset);
+                if (taken > 0 && taken + record_size > max_bytes) {
+                    return true;
+                }
+                out.append(records, offset, record_size);
+                taken += record_size;
+                offset += record_size;
+                ++last;
+            }
+        }
+        return true;
+    }
+
+    // Sequence number of the last synced record
+    uint64_t feed_sequence() const {
+        lock_guard<mutex> lock(feed_mutex);
+        return feed_last_sequence;
+    }
+
+    // Call wake() after each group of records is synced, until
+    // unsubscribe; wake runs on the committing thread and must not block
+    size_t subscribe(function<void()> wake) {
+        lock_guard<mutex> lock(feed_mutex);
+        subscribers.emplace(next_subscriber, move(wake));
+        return next_subscriber++;
+    }
+
+    void unsubscribe(size_t subscription) {
+        lock_guard<mutex> lock(feed_mutex);
+        subscribers.erase(subscription);
+    }
+
+    // Discard all records once a checkpoint covers them. The checkpoint
+    // makes the whole state durable, so this also clears a failure.
+    void reset() {
+        unique_lock<mutex> lock(journal_mutex);
+        synced.wait(lock, [this] { return !syncing; });
+        fclose(file);
+        file = nullptr;
+        // Unsynced records are covered by the checkpoint; the feed still
+        // needs them
+        if (!buffer.empty()) {
+            publish(durable_sequence + 1, last_sequence, buffer);
+        }
+        buffer.clear();
+        durable_sequence = last_sequence;
+        failed = false;
+        open_file("wb");
+        synced.notify_all();
+    }
+
+    // Decode the records in a journal file with sequence numbers above
+    // after_sequence and pass each to apply. A torn or corrupt tail is cut
+    // off. Returns the number of records applied.
+    template <typename Apply>
+    static size_t replay(const string& journal_path, uint64_t after_sequence, Apply&& apply) {
+        if (!filesystem::exists(journal_path) || filesystem::file_size(journal_path) == 0) {
+            return 0;
+        }
+        size_t applied = 0;
+        size_t valid_end;
+        size_t file_size;
+        {
+            MappedFile mapped(journal_path);
+            const char* data = mapped.data();
+            file_size = mapped.size();
+            if (file_size < header_size || memcmp(data, magic, sizeof(magic)) != 0) {
+                throw TaskManagerException("Not an operation journal: " + journal_path);
+            }
+            size_t offset = header_size;
+            JournalRecord record;
+            while (size_t record_size = decode_record(data + offset, file_size - offset, record)) {
+                if (record.sequence > after_sequence) {
+                    apply(record);
+                    ++applied;
+                }
+                offset += record_size;
+            }
+            valid_end = offset;
+        }
+        if (valid_end < file_size) {
+            filesystem::resize_file(journal_path, valid_end);
+        }
+        return applied;
+    }
+};
+
+// Snapshot file layout (host byte order). A SnapshotHeader is followed by
+// 8-byte aligned sections, each a flat array of fixed-size records:
+//   task ids            uint32_t[task_count]
+//   completed bitset    uint64_t[(task_count + 63) / 64]
+//   due days            int32_t[task_count]
+//   descriptions        SnapshotString[task_count]
+//   undo log            SnapshotChange[undo_count]
+//   redo log            SnapshotChange[redo_count]
+//   string table        char[string_table_size]
+// Loading maps the file and copies each column in one go; descriptions keep
+// pointing into the mapping. Versions 1 and 2 stored the history as
+// 16-byte mementos; their tasks still load but the history is dropped.
+// Only history resident in memory is saved; spilled segments are scratch.
+// Journaled undo and redo records carry their changes, so replaying them
+// after a checkpoint does not need the history that was dropped.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t task_count;
+    uint64_t next_id;
+    uint64_t undo_count;
+    uint64_t redo_count;
+    uint64_t string_table_size;
+    uint64_t journal_sequence;  // last journal record reflected (version 2+)
+};
+
+struct SnapshotString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct SnapshotChange {
+    uint8_t kind;
+    uint8_t unit_start;
+    uint8_t completed;
+    uint8_t reserved;
+    uint32_t id;
+    uint32_t slot;
+    int32_t due_day;
+    SnapshotString description;
+};
+
+constexpr size_t snapshot_v2_memento_size = 16;
+
+constexpr char snapshot_magic[8] = {'T', 'O', 'D', 'O', 'S', 'N', 'A', 'P'};
+constexpr uint32_t snapshot_version = 3;
+constexpr size_t snapshot_v1_header_size = offsetof(SnapshotHeader, journal_sequence);
+
+// Round a section size up to the snapshot's 8-byte alignment
+inline size_t snapshot_align(size_t size) {
+    return (size + 7) & ~size_t(7);
+}
+
+// Compressed snapshot file: the same image as above, made smaller, for
+// disk and backups. A CompressedSnapshotHeader and a block table are
+// followed by LZ4 blocks of a payload in which
+//   task ids and due days   are zigzag varints of the difference from the row before
+//   descriptions            give each string's text on first use, front-coded
+//                           against the previous new string; repeats are a
+//                           varint distance back into the string table
+// and everything else is copied as it is. Blocks are independent and each
+// carries the crc32 of its decompressed bytes, so they decompress in
+// parallel and corruption is caught before anything is loaded.
+struct CompressedSnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t payload_size;
+    uint64_t block_count;
+    uint32_t table_checksum;    // crc32 of the block table
+    uint32_t reserved;
+};
+
+struct CompressedSnapshotBlock {
+    uint32_t stored_size;       // high bit: stored uncompressed
+    uint32_t checksum;          // crc32 of the decompressed block
+};
+
+constexpr char compressed_snapshot_magic[8] = {'T', 'O', 'D', 'O', 'S', 'N', 'P', 'Z'};
+constexpr uint32_t compressed_snapshot_version = 1;
+
+// How save_snapshot and checkpoints write the snapshot file; loading
+// accepts either
+enum class SnapshotFormat {
+    Mapped,      // loads by mapping the file, descriptions included
+    Compressed   // several times smaller; loads by decompressing in parallel
+};
+
+class SnapshotCodec {
+private:
+    static constexpr size_t block_size = 256 * 1024;
+    static constexpr uint32_t stored_flag = 0x80000000u;
+
+    static void put_varint(string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out += static_cast<char>(value | 0x80);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+
+    static uint64_t zigzag(int64_t value) {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    static int64_t unzigzag(uint64_t value) {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    // Bounds-checked reader over the decompressed payload
+    struct Reader {
+        const char* data;
+        size_t size;
+        size_t offset = 0;
+
+        [[noreturn]] static void corrupt() {
+            throw TaskManagerException("Corrupt compressed snapshot");
+        }
+
+        const char* take(uint64_t bytes) {
+            if (bytes > size - offset) {
+                corrupt();
+            }
+            const char* start = data + offset;
+            offset += static_cast<size_t>(bytes);
+            return start;
+        }
+
+        uint64_t varint() {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                uint8_t byte = static_cast<uint8_t>(*take(1));
+                value |= uint64_t(byte & 0x7F) << shift;
+                if (byte < 0x80) {
+                    return value;
+                }
+            }
+            corrupt();
+        }
+    };
+
+    // Spread count items over the shared pool in at most a few chunks per thread
+    template <typename Body>
+    static void for_each_parallel(size_t count, Body&& body) {
+        ThreadPool& pool = ThreadPool::shared();
+        size_t chunks = min(count, pool.concurrency() * 4);
+        pool.parallel_for(chunks, [&](size_t chunk) {
+            for (size_t i = count * chunk / chunks; i < count * (chunk + 1) / chunks; ++i) {
+                body(i);
+            }
+        });
+    }
+
+    static string filter(const string& image) {
+        SnapshotHeader header;
+        memcpy(&header, image.data(), sizeof(header));
+        size_t count = static_cast<size_t>(header.task_count);
+        size_t offset = snapshot_align(sizeof(header));
+        auto section = [&](size_t bytes) {
+            const char* start = image.data() + offset;
+            offset += snapshot_align(bytes);
+            return start;
+        };
+        const char* ids = section(count * sizeof(TaskId));
+        const char* words = section((count + 63) / 64 * sizeof(uint64_t));
+        const char* days = section(count * sizeof(int32_t));
+        const char* refs = section(count * sizeof(SnapshotString));
+        const char* undo = section(static_cast<size_t>(header.undo_count) * sizeof(SnapshotChange));
+        const char* redo = section(static_cast<size_t>(header.redo_count) * sizeof(SnapshotChange));
+        const char* strings = section(static_cast<size_t>(header.string_table_size));
+
+        string out;
+        out.reserve(image.size() / 2);
+        out.append(image.data(), sizeof(header));
+        int64_t previous = 0;
+        for (size_t row = 0; row < count; ++row) {
+            TaskId id;
+            memcpy(&id, ids + row * sizeof(id), sizeof(id));
+            put_varint(out, zigzag(int64_t(id) - previous));
+            previous = id;
+        }
+        out.append(words, (count + 63) / 64 * sizeof(uint64_t));
+        previous = 0;
+        for (size_t row = 0; row < count; ++row) {
+            int32_t day;
+            memcpy(&day, days + row * sizeof(day), sizeof(day));
+            put_varint(out, zigzag(int64_t(day) - previous));
+            previous = day;
+        }
+        // write_snapshot adds each row's string on first use, so a ref
+        // either starts where the text so far ends or points back into it
+        uint32_t text_end = 0;
+        string_view last_new;
+        for (size_t row = 0; row < count; ++row) {
+            SnapshotString ref;
+            memcpy(&ref, refs + row * sizeof(ref), sizeof(ref));
+            if (ref.offset > text_end) {
+                throw TaskManagerException("Snapshot string table out of order");
+            }
+            if (ref.offset < text_end) {
+                put_varint(out, text_end - ref.offset);
+                put_varint(out, ref.length);
+                continue;
+            }
+            string_view text(strings + ref.offset, ref.length);
+            size_t shared = 0;
+            while (shared < min(text.size(), last_new.size()) && text[shared] == last_new[shared]) {
+                ++shared;
+            }
+            put_varint(out, 0);
+            put_varint(out, shared);
+            put_varint(out, text.size() - shared);
+            out.append(text.data() + shared, text.size() - shared);
+            text_end += ref.length;
+            last_new = text;
+        }
+        out.append(undo, static_cast<size_t>(header.undo_count) * sizeof(SnapshotChange));
+        out.append(redo, static_cast<size_t>(header.redo_count) * sizeof(SnapshotChange));
+        out.append(strings + text_end, static_cast<size_t>(header.string_table_size) - text_end);
+        return out;
+    }
+
+    static string unfilter(const char* payload, size_t payload_size) {
+        Reader in{payload, payload_size};
+        SnapshotHeader header;
+        memcpy(&header, in.take(sizeof(header)), sizeof(header));
+        if (memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0 || header.version != snapshot_version) {
+            Reader::corrupt();
+        }
+        // Every row and history record takes at least a byte of payload
+        if (header.task_count > payload_size || header.undo_count > payload_size
+            || header.redo_count > payload_size || header.string_table_size > UINT32_MAX) {
+            Reader::corrupt();
+        }
+        size_t count = static_cast<size_t>(header.task_count);
+        size_t undo_bytes = static_cast<size_t>(header.undo_count) * sizeof(SnapshotChange);
+        size_t redo_bytes = static_cast<size_t>(header.redo_count) * sizeof(SnapshotChange);
+        size_t string_bytes = static_cast<size_t>(header.string_table_size);
+        size_t sizes[] = {sizeof(header), count * sizeof(TaskId), (count + 63) / 64 * sizeof(uint64_t),
+                          count * sizeof(int32_t), count * sizeof(SnapshotString), undo_bytes, redo_bytes,
+                          string_bytes};
+        size_t total = 0;
+        for (size_t size : sizes) {
+            total += snapshot_align(size);
+        }
+        string image(total, '\0');
+        char* out = &image[0];
+        vector<char*> sections;
+        for (size_t size : sizes) {
+            sections.push_back(out);
+            out += snapshot_align(size);
+        }
+        memcpy(sections[0], &header, sizeof(header));
+        int64_t previous = 0;
+        for (size_t row = 0; row < count; ++row) {
+            previous += unzigzag(in.varint());
+            TaskId id = static_cast<TaskId>(previous);
+            memcpy(sections[1] + row * sizeof(id), &id, sizeof(id));
+        }
+        memcpy(sections[2], in.take(sizes[2]), sizes[2]);
+        previous = 0;
+        for (size_t row = 0; row < count; ++row) {
+            previous += unzigzag(in.varint());
+            int32_t day = static_cast<int32_t>(previous);
+            memcpy(sections[3] + row * sizeof(day), &day, sizeof(day));
+        }
+        char* strings = sections[7];
+        uint64_t text_end = 0;
+        uint64_t last_new = 0;      // offset of the previous new string
+        uint64_t last_length = 0;
+        for (size_t row = 0; row < count; ++row) {
+            uint64_t distance = in.varint();
+            SnapshotString ref;
+            if (distance > 0) {
+                uint64_t length = in.varint();
+                if (distance > text_end || length > string_bytes) {
+                    Reader::corrupt();
+                }
+                ref = {static_cast<uint32_t>(text_end - distance), static_cast<uint32_t>(length)};
+            } else {
+                uint64_t shared = in.varint();
+                uint64_t suffix = in.varint();
+                if (shared > last_length || shared > string_bytes - text_end
+                    || suffix > string_bytes - text_end - shared) {
+                    Reader::corrupt();
+                }
+                memmove(strings + text_end, strings + last_new, static_cast<size_t>(shared));
+                memcpy(strings + text_end + shared, in.take(suffix), static_cast<size_t>(suffix));
+                ref = {static_cast<uint32_t>(text_end), static_cast<uint32_t>(shared + suffix)};
+                last_new = text_end;
+                last_length = shared + suffix;
+                text_end += shared + suffix;
+            }
+            memcpy(sections[4] + row * sizeof(ref), &ref, sizeof(ref));
+        }
+        memcpy(sections[5], in.take(undo_bytes), undo_bytes);
+        memcpy(sections[6], in.take(redo_bytes), redo_bytes);
+        memcpy(strings + text_end, in.take(string_bytes - text_end), static_cast<size_t>(string_bytes - text_end));
+        if (in.offset != payload_size) {
+            Reader::corrupt();
+        }
+        return image;
+    }
+
+public:
+    static bool is_compressed(const char* data, size_t size) {
+        return size >= sizeof(compressed_snapshot_magic)
+            && memcmp(data, compressed_snapshot_magic, sizeof(compressed_snapshot_magic)) == 0;
+    }
+
+    // Compress a snapshot image as laid out by write_snapshot
+    static string encode(const string& image) {
+        string payload = filter(image);
+        size_t block_count = (payload.size() + block_size - 1) / block_size;
+        vector<string> packed(block_count);
+        vector<CompressedSnapshotBlock> table(block_count);
+        for_each_parallel(block_count, [&](size_t block) {
+            const char* raw = payload.data() + block * block_size;
+            size_t raw_size = min(block_size, payload.size() - block * block_size);
+            packed[block].resize(Lz4::compress_bound(raw_size));
+            size_t size = Lz4::compress(raw, raw_size, &packed[block][0]);
+            if (size >= raw_size) {
+                packed[block].assign(raw, raw_size);
+                table[block].stored_size = static_cast<uint32_t>(raw_size) | stored_flag;
+            } else {
+                packed[block].resize(size);
+                table[block].stored_size = static_cast<uint32_t>(size);
+            }
+            table[block].checksum = crc32(raw, raw_size);
+        });
+
+        CompressedSnapshotHeader header = {};
+        memcpy(header.magic, compressed_snapshot_magic, sizeof(header.magic));
+        header.version = compressed_snapshot_version;
+        header.block_size = block_size;
+        header.payload_size = payload.size();
+        header.block_count = block_count;
+        header.table_checksum = crc32(reinterpret_cast<const char*>(table.data()),
+            table.size() * sizeof(CompressedSnapshotBlock));
+        string out(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.append(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(CompressedSnapshotBlock));
+        for (const string& block : packed) {
+            out += block;
+        }
+        return out;
+    }
+
+    // Decompress a file written by encode back into the snapshot image
+    static string decode(const char* data, size_t size) {
+        CompressedSnapshotHeader header;
+        if (size < sizeof(header)) {
+            Reader::corrupt();
+        }
+        memcpy(&header, data, sizeof(header));
+        if (header.version != compressed_snapshot_version) {
+            throw TaskManagerException("Unsupported compressed snapshot version " + to_string(header.version));
+        }
+        size_t table_bytes = static_cast<size_t>(header.block_count) * sizeof(CompressedSnapshotBlock);
+        // LZ4 expands at most 255 times, so a sane payload fits the file
+        if (header.block_size == 0 || header.block_size >= stored_flag || header.payload_size / 255 > size
+            || header.block_count > (size - sizeof(header)) / sizeof(CompressedSnapshotBlock)
+            || header.block_count != (header.payload_size + header.block_size - 1) / header.block_size
+            || crc32(data + sizeof(header), table_bytes) != header.table_checksum) {
+            Reader::corrupt();
+        }
+        vector<CompressedSnapshotBlock> table(static_cast<size_t>(header.block_count));
+        memcpy(table.data(), data + sizeof(header), table_bytes);
+        vector<size_t> offsets(table.size() + 1, sizeof(header) + table_bytes);
+        for (size_t block = 0; block < table.size(); ++block) {
+            offsets[block + 1] = offsets[block] + (table[block].stored_size & ~stored_flag);
+        }
+        if (offsets.back() != size) {
+            Reader::corrupt();
+        }
+        string payload(static_cast<size_t>(header.payload_size), '\0');
+        atomic<bool> intact{true};
+        for_each_parallel(table.size(), [&](size_t block) {
+            char* raw = &payload[0] + block * header.block_size;
+            size_t raw_size = min<size_t>(header.block_size, payload.size() - block * header.block_size);
+            const char* stored = data + offsets[block];
+            size_t stored_size = offsets[block + 1] - offsets[block];
+            bool ok = (table[block].stored_size & stored_flag)
+                ? stored_size == raw_size && (memcpy(raw, stored, raw_size), true)
+                : Lz4::decompress(stored, stored_size, raw, raw_size);
+            if (!ok || crc32(raw, raw_size) != table[block].checksum) {
+                intact = false;
+            }
+        });
+        if (!intact) {
+            Reader::corrupt();
+        }
+        return unfilter(payload.data(), payload.size());
+    }
+};
+
+// Ordered index of task ids by due day. Each day's ids are kept sorted;
+// ids grow in list order, so that is also list order within a day. Range
+// queries cost O(log d + k) for d distinct days and k visited tasks.
+class DueDateIndex {
+private:
+    map<int32_t, vector<TaskId>> days;
+
+public:
+    void insert(int32_t due_day, TaskId id) {
+        auto& bucket = days[due_day];
+        bucket.insert(upper_bound(bucket.begin(), bucket.end(), id), id);
+    }
+
+    void erase(int32_t due_day, TaskId id) {
+        auto it = days.find(due_day);
+        if (it == days.end()) {
+            return;
+        }
+        auto& bucket = it->second;
+        auto position = lower_bound(bucket.begin(), bucket.end(), id);
+        if (position != bucket.end() && *position == id) {
+            bucket.erase(position);
+        }
+        if (bucket.empty()) {
+            days.erase(it);
+        }
+    }
+
+    // Call visit(id) for tasks due on or between the two days, by due day
+    template <typename Visitor>
+    void for_each_between(int32_t first_day, int32_t last_day, Visitor&& visit) const {
+        for (auto it = days.lower_bound(first_day); it != days.end() && it->first <= last_day; ++it) {
+            for (TaskId id : it->second) {
+                visit(id);
+            }
+        }
+    }
+
+    void clear() {
+        days.clear();
+    }
+};
+
+// Indexed binary min-heap of pending tasks keyed by (due day, id). The
+// position map lets completion, deletion and undo/redo take a task out of
+// the middle in O(log n); top_k walks the heap without disturbing it.
+class PendingDueHeap {
+private:
+    struct Entry {
+        int32_t due_day;
+        TaskId id;
+    };
+
+    vector<Entry> heap;
+    unordered_map<TaskId, uint32_t> position;
+
+    static bool before(const Entry& left, const Entry& right) {
+        return left.due_day != right.due_day ? left.due_day < right.due_day : left.id < right.id;
+    }
+
+    void place(uint32_t index, const Entry& entry) {
+        heap[index] = entry;
+        position[entry.id] = index;
+    }
+
+    void sift_up(uint32_t index) {
+        Entry entry = heap[index];
+        while (index > 0) {
+            uint32_t parent = (index - 1) / 2;
+            if (!before(entry, heap[parent])) {
+                break;
+            }
+            place(index, heap[parent]);
+            index = parent;
+        }
+        place(index, entry);
+    }
+
+    void sift_down(uint32_t index) {
+        Entry entry = heap[index];
+        uint32_t count = static_cast<uint32_t>(heap.size());
+        while (true) {
+            uint32_t child = 2 * index + 1;
+            if (child >= count) {
+                break;
+            }
+            if (child + 1 < count && before(heap[child + 1], heap[child])) {
+                ++child;
+            }
+            if (!before(heap[child], entry)) {
+                break;
+            }
+            place(index, heap[child]);
+            index = child;
+        }
+        place(index, entry);
+    }
+
+public:
+    size_t size() const {
+        return heap.size();
+    }
+
+    void reserve(size_t count) {
+        heap.reserve(count);
+        position.reserve(count);
+    }
+
+    void push(int32_t due_day, TaskId id) {
+        heap.push_back({due_day, id});
+        sift_up(static_cast<uint32_t>(heap.size() - 1));
+    }
+
+    // Drop a task if it is in the heap
+    void erase(TaskId id) {
+        auto it = position.find(id);
+        if (it == position.end()) {
+            return;
+        }
+        uint32_t index = it->second;
+        position.erase(it);
+        Entry last = heap.back();
+        heap.pop_back();
+        if (index == heap.size()) {
+            return;
+        }
+        place(index, last);
+        if (index > 0 && before(last, heap[(index - 1) / 2])) {
+            sift_up(index);
+        } else {
+            sift_down(index);
+        }
+    }
+
+    void clear() {
+        heap.clear();
+        position.clear();
+    }
+
+    // Call visit(id) for the k soonest-due tasks in order, in O(k log k)
+    // time. The frontier is a second heap of indices into this one; it is
+    // thread-local so concurrent readers stop allocating once it has grown.
+    template <typename Visitor>
+    size_t top_k(size_t k, Visitor&& visit) const {
+        thread_local vector<uint32_t> frontier;
+        frontier.clear();
+        auto later = [this](uint32_t left, uint32_t right) { return before(heap[right], heap[left]); };
+        if (!heap.empty() && k > 0) {
+            frontier.push_back(0);
+        }
+        size_t visited = 0;
+        while (!frontier.empty() && visited < k) {
+            pop_heap(frontier.begin(), frontier.end(), later);
+            uint32_t index = frontier.back();
+            frontier.pop_back();
+            visit(heap[index].id);
+            ++visited;
+            for (uint32_t child = 2 * index + 1; child <= 2 * index + 2 && child < heap.size(); ++child) {
+                frontier.push_back(child);
+                push_heap(frontier.begin(), frontier.end(), later);
+            }
+        }
+        return visited;
+    }
+};
+
+// Task counts as of one day: overdue tasks are pending and due before it
+struct TaskStats {
+    size_t total = 0;
+    size_t pending = 0;
+    size_t completed = 0;
+    size_t overdue = 0;
+    int32_t today = 0;
+};
+
+// Write stats as one summary line
+inline void print_stats(const TaskStats& stats, ostream& out = cout) {
+    out << stats.total << " tasks: " << stats.pending << " pending, " << stats.completed
+        << " completed, " << stats.overdue << " overdue\n";
+}
+
+// Pending and completed tasks due on one day
+struct DayCounts {
+    uint32_t pending = 0;
+    uint32_t completed = 0;
+};
+
+// Task counts and a per-day due histogram, kept up to date by every row
+// change so reading them never touches the task columns. The overdue count
+// is relative to a cached day; advance() moves it when the date changes,
+// costing O(d) for the d histogram days passed over.
+class TaskCounters {
+private:
+    map<int32_t, DayCounts> days;
+    size_t pending = 0;
+    size_t completed = 0;
+    size_t overdue = 0;
+    int32_t today = INT32_MIN;
+
+    void count_pending(int32_t due_day, bool added) {
+        if (due_day < today) {
+            overdue = added ? overdue + 1 : overdue - 1;
+        }
+    }
+
+public:
+    void insert(int32_t due_day, bool is_completed) {
+        DayCounts& day = days[due_day];
+        if (is_completed) {
+            ++day.completed;
+            ++completed;
+        } else {
+            ++day.pending;
+            ++pending;
+            count_pending(due_day, true);
+        }
+    }
+
+    void erase(int32_t due_day, bool is_completed) {
+        auto it = days.find(due_day);
+        if (it == days.end()) {
+            return;
+        }
+        if (is_completed) {
+            --it->second.completed;
+            --completed;
+        } else {
+            --it->second.pending;
+            --pending;
+            count_pending(due_day, false);
+        }
+        if (it->second.pending == 0 && it->second.completed == 0) {
+            days.erase(it);
+        }
+    }
+
+    // Move one task due on due_day between pending and completed
+    void set_completed(int32_t due_day, bool is_completed) {
+        DayCounts& day = days[due_day];
+        if (is_completed) {
+            --day.pending;
+            ++day.completed;
+            --pending;
+            ++completed;
+        } else {
+            ++day.pending;
+            --day.completed;
+            ++pending;
+            --completed;
+        }
+        count_pending(due_day, !is_completed);
+    }
+
+    bool current(int32_t day) const {
+        return today == day;
+    }
+
+    // Recount overdue tasks as of day from the histogram days between the
+    // cached day and the new one
+    void advance(int32_t day) {
+        if (day > today) {
+            for (auto it = days.lower_bound(today); it != days.end() && it->first < day; ++it) {
+                overdue += it->second.pending;
+            }
+        } else {
+            for (auto it = days.lower_bound(day); it != days.end() && it->first < today; ++it) {
+                overdue -= it->second.pending;
+            }
+        }
+        today = day;
+    }
+
+    TaskStats summary() const {
+        TaskStats stats;
+        stats.total = pending + completed;
+        stats.pending = pending;
+        stats.completed = completed;
+        stats.overdue = overdue;
+        stats.today = today;
+        return stats;
+    }
+
+    // Call visit(day, DayCounts) for each day between the two that has tasks
+    template <typename Visitor>
+    void for_each_day(int32_t first_day, int32_t last_day, Visitor&& visit) const {
+        for (auto it = days.lower_bound(first_day); it != days.end() && it->first <= last_day; ++it) {
+            visit(it->first, it->second);
+        }
+    }
+
+    void clear() {
+        days.clear();
+        pending = 0;
+        completed = 0;
+        overdue = 0;
+        today = INT32_MIN;
+    }
+};
+
+// Caps on resident undo/redo history; 0 means no cap. Past the cap the
+// oldest half of a log is spilled to a segment file and paged back in
+// only when undo or redo reaches it.
+struct HistoryLimits {
+    size_t max_entries = 1 << 20;
+    size_t max_bytes = 0;
+    string spill_path;  // empty: an anonymous temporary file
+};
+
+// Stack of TaskChange records whose oldest entries live in a disk-backed
+// segment file. Spilled changes are packed as a flags byte and the id,
+// plus slot, due day and description handle for adds and deletes. Handles
+// stay valid because the task pool only changes wholesale, on snapshot
+// load, which replaces the history too.
+class ChangeHistory {
+private:
+    struct Segment {
+        uint64_t offset;
+        uint64_t bytes;
+    };
+
+    vector<TaskChange> resident;
+    vector<Segment> segments;
+    size_t spilled = 0;
+    size_t max_resident = 0;
+    HistoryLimits limits;
+    FILE* spill_file = nullptr;
+    uint64_t spill_end = 0;
+
+    void open_spill_file() {
+        spill_file = limits.spill_path.empty() ? tmpfile() : fopen(limits.spill_path.c_str(), "w+b");
+        if (!spill_file) {
+            throw TaskManagerException("Cannot open undo spill file");
+        }
+    }
+
+    // Move the oldest half of the resident changes to a new segment
+    void spill() {
+        if (!spill_file) {
+            open_spill_file();
+        }
+        size_t count = resident.size() / 2;
+        string packed;
+        for (size_t i = 0; i < count; ++i) {
+            const TaskChange& change = resident[i];
+            uint8_t flags = static_cast<uint8_t>(change.kind) | (change.unit_start ? 4 : 0)
+                | (change.completed ? 8 : 0);
+            packed += static_cast<char>(flags);
+            packed.append(reinterpret_cast<const char*>(&change.id), sizeof(change.id));
+            if (change.kind != TaskChange::Kind::Complete) {
+                packed.append(reinterpret_cast<const char*>(&change.slot), sizeof(change.slot));
+                packed.append(reinterpret_cast<const char*>(&change.due_day), sizeof(change.due_day));
+                packed.append(reinterpret_cast<const char*>(&change.description), sizeof(change.description));
+            }
+        }
+        if (fseek(spill_file, static_cast<long>(spill_end), SEEK_SET) != 0
+            || fwrite(packed.data(), 1, packed.size(), spill_file) != packed.size()) {
+            throw TaskManagerException("Cannot write undo spill file");
+        }
+        segments.push_back({spill_end, packed.size()});
+        spill_end += packed.size();
+        spilled += count;
+        resident.erase(resident.begin(), resident.begin() + count);
+    }
+
+    // Read the newest segment back in front of the resident changes
+    void page_in() {
+        Segment segment = segments.back();
+        string packed(static_cast<size_t>(segment.bytes), '\0');
+        fflush(spill_file);
+        if (fseek(spill_file, static_cast<long>(segment.offset), SEEK_SET) != 0
+            || fread(&packed[0], 1, packed.size(), spill_file) != packed.size()) {
+            throw TaskManagerException("Cannot read undo spill file");
+        }
+        vector<TaskChange> loaded;
+        size_t offset = 0;
+        while (offset < packed.size()) {
+            uint8_t flags = static_cast<uint8_t>(packed[offset++]);
+            TaskChange change = TaskChange::of(static_cast<TaskChange::Kind>(flags & 3), 0);
+            change.unit_start = (flags & 4) != 0;
+            change.completed = (flags & 8) != 0;
+            memcpy(&change.id, &packed[offset], sizeof(change.id));
+            offset += sizeof(change.id);
+            if (change.kind != TaskChange::Kind::Complete) {
+                memcpy(&change.slot, &packed[offset], sizeof(change.slot));
+                memcpy(&change.due_day, &packed[offset + 4], sizeof(change.due_day));
+                memcpy(&change.description, &packed[offset + 8], sizeof(change.description));
+                offset += 12;
+            }
+            loaded.push_back(change);
+        }
+        segments.pop_back();
+        spill_end = segment.offset;
+        spilled -= loaded.size();
+        resident.insert(resident.begin(), loaded.begin(), loaded.end());
+    }
+
+public:
+    ChangeHistory() {
+        set_limits(HistoryLimits());
+    }
+
+    ChangeHistory(const ChangeHistory&) = delete;
+    ChangeHistory& operator=(const ChangeHistory&) = delete;
+
+    ~ChangeHistory() {
+        if (spill_file) {
+            fclose(spill_file);
+            if (!limits.spill_path.empty()) {
+                remove(limits.spill_path.c_str());
+            }
+        }
+    }
+
+    void set_limits(const HistoryLimits& new_limits) {
+        limits = new_limits;
+        max_resident = SIZE_MAX;
+        if (limits.max_entries > 0) {
+            max_resident = limits.max_entries;
+        }
+        if (limits.max_bytes > 0) {
+            max_resident = min(max_resident, max<size_t>(limits.max_bytes / sizeof(TaskChange), 2));
+        }
+        while (resident.size() > max_resident) {
+            spill();
+        }
+    }
+
+    bool empty() const {
+        return resident.empty() && segments.empty();
+    }
+
+    size_t size() const {
+        return resident.size() + spilled;
+    }
+
+    // Changes currently held in memory, oldest first
+    const vector<TaskChange>& resident_changes() const {
+        return resident;
+    }
+
+    void reserve(size_t count) {
+        resident.reserve(min(count, max_resident));
+    }
+
+    void push_back(const TaskChange& change) {
+        resident.push_back(change);
+        if (resident.size() > max_resident) {
+            spill();
+        }
+    }
+
+    const TaskChange& back() {
+        if (resident.empty()) {
+            page_in();
+        }
+        return resident.back();
+    }
+
+    void pop_back() {
+        if (resident.empty()) {
+            page_in();
+        }
+        resident.pop_back();
+    }
+
+    void clear() {
+        resident.clear();
+        segments.clear();
+        spilled = 0;
+        spill_end = 0;
+    }
+
+    // Replace the history with changes loaded from a snapshot
+    void assign(vector<TaskChange> changes) {
+        clear();
+        resident = move(changes);
+        while (resident.size() > max_resident) {
+            spill();
+        }
+    }
+};
+
+// How TodoListManager splits filter scans across the shared thread pool
+struct ParallelOptions {
+    size_t threads = 0;                 // 0: every hardware thread; 1: always serial
+    size_t serial_below = 64 * 1024;    // lists with fewer tasks scan serially
+};
+
+// Task list manager. Safe for concurrent use: readers (views, counts,
+// snapshots) share the state lock and writers hold it exclusively. Journal
+// records are appended under the lock but made durable after it is
+// released, so concurrent writers share one fsync.
+class TodoListManager {
+private:
+    // Indexes derived from the store. A snapshot load leaves them unbuilt;
+    // each is built on first use and only maintained once built.
+    enum Index : uint8_t {
+        DescriptionLookup = 1,
+        DueDays = 2,
+        PendingDue = 4,
+        Search = 8,
+        Counters = 16,
+        AllIndexes = 31
+    };
+
+    mutable shared_mutex state_mutex;
+    TaskStore tasks;
+    mutable DescriptionIndex description_index;
+    mutable DueDateIndex due_index;
+    mutable PendingDueHeap pending_due;
+    mutable SearchIndex search_index;
+    mutable TaskCounters counters;
+    mutable uint8_t built_indexes = AllIndexes;
+    ChangeHistory undo_log;
+    ChangeHistory redo_log;
+    bool starting_unit = false;
+    unique_ptr<OperationJournal> journal;
+    string checkpoint_path;
+    uint64_t applied_sequence = 0;
+    ParallelOptions parallel;
+    bool read_only = false;
+    SnapshotFormat snapshot_format = SnapshotFormat::Mapped;
+
+public:
+    // Recover from the checkpoint snapshot plus the journal, then record every
+    // later change in the journal before applying it
+    void open_journal(const string& journal_path, const string& snapshot_path,
+                      const OperationJournal::Options& options = OperationJournal::Options()) {
+        unique_lock<shared_mutex> lock(state_mutex);
+        journal.reset();
+        checkpoint_path = snapshot_path;
+        if (filesystem::exists(snapshot_path)) {
+            read_snapshot(snapshot_path);
+        }
+        size_t replayed = OperationJournal::replay(journal_path, applied_sequence,
+            [this](const JournalRecord& record) { apply_record(record); });
+        journal.reset(new OperationJournal(journal_path, applied_sequence, options));
+        Logger::info("Journal replayed: ", replayed, " operations");
+    }
+
+    // Cap the resident undo and redo history
+    void set_history_limits(const HistoryLimits& limits) {
+        unique_lock<shared_mutex> lock(state_mutex);
+        undo_log.set_limits(limits);
+        HistoryLimits redo_limits = limits;
+        if (!redo_limits.spill_path.empty()) {
+            redo_limits.spill_path += ".redo";
+        }
+        redo_log.set_limits(redo_limits);
+    }
+
+    // Write a snapshot covering the journal so far and truncate the journal
+    void checkpoint() {
+        ScopedTimer timer(Metrics::Op::Checkpoint);
+        unique_lock<shared_mutex> lock(state_mutex);
+        checkpoint_locked();
+    }
+
+    // Add a task to the task list; the task is copied into the store
+    void add_task(const Task& task) {
+        ScopedTimer timer(Metrics::Op::Add);
+        write([&] { return apply_add(task); });
+    }
+
+
+    // Mark a task as completed
+    bool mark_completed(string_view description) {
+        ScopedTimer timer(Metrics::Op::Complete);
+        return write([&] { return apply_complete(description); });
+    }
+
+    // Delete a task from the task list
+    bool delete_task(string_view description) {
+        ScopedTimer timer(Metrics::Op::Delete);
+        return write([&] { return apply_delete(description); });
+    }
+
+    // Mark every pending task matching filter as completed, as one undoable
+    // unit; returns how many tasks were completed
+    size_t complete_matching(const TaskFilter& filter) {
+        ScopedTimer timer(Metrics::Op::CompleteMatching);
+        size_t completed = 0;
+        write([&] {
+            completed = apply_complete_matching(filter);
+            return completed > 0;
+        });
+        return completed;
+    }
+
+    // Choose the thread count and size threshold for parallel scans
+    void set_parallelism(const ParallelOptions& options) {
+        unique_lock<shared_mutex> lock(state_mutex);
+        parallel = options;
+    }
+
+    // Choose how save_snapshot and checkpoints write snapshots
+    void set_snapshot_format(SnapshotFormat format) {
+        unique_lock<shared_mutex> lock(state_mutex);
+        snapshot_format = format;
+    }
+
+    // Undo the last operation
+    void undo() {
+        ScopedTimer timer(Metrics::Op::Undo);
+        write([&] { return apply_undo(); });
+    }
+
+    // Redo the last undone operation
+    void redo() {
+        ScopedTimer timer(Metrics::Op::Redo);
+        write([&] { return apply_redo(); });
+    }
+
+    // Apply many commands under one lock acquisition, one journal record and
+    // one log line. The whole batch is a single step for undo and redo.
+    BatchResult apply_batch(const TaskCommand* commands, size_t count) {
+        ScopedTimer timer(Metrics::Op::Batch);
+        BatchResult result;
+        write([&] {
+            result = apply_batch_locked(commands, count, nullptr, false);
+            return true;
+        });
+        return result;
+    }
+
+    // Apply commands as if one by one, each its own undo step, but under
+    // one lock acquisition and one journal record. applied[i], when given,
+    // is set to whether command i took effect.
+    BatchResult apply_pipelined(const TaskCommand* commands, size_t count, bool* applied = nullptr) {
+        ScopedTimer timer(Metrics::Op::Batch);
+        BatchResult result;
+        write([&] {
+            result = apply_batch_locked(commands, count, applied, true);
+            return true;
+        });
+        return result;
+    }
+
+    BatchResult apply_batch(const vector<TaskCommand>& commands) {
+        return apply_batch(commands.data(), commands.size());
+    }
+
+    // Call visit(TaskView) for every task matching filter, in list order,
+    // while holding the state lock shared; visit must not call the writers
+    template <typename Visitor>
+    void for_each_task(const TaskFilter& filter, Visitor&& visit) const {
+        shared_lock<shared_mutex> lock(state_mutex);
+        filter.for_each(tasks, visit);
+    }
+
+    // Call visit(TaskView) for every task matching a due-bounded filter, in
+    // due-date order, through the due-date index
+    template <typename Visitor>
+    void for_each_due(const TaskFilter& filter, Visitor&& visit) const {
+        shared_lock<shared_mutex> lock = lock_with_indexes(DueDays);
+        due_index.for_each_between(filter.first_day(), filter.last_day(), [&](TaskId id) {
+            uint32_t slot = tasks.slot(id);
+            if (filter.matches(tasks, slot)) {
+                visit(TaskView(tasks, slot));
+            }
+        });
+    }
+
+    // Call visit(TaskView) for the k soonest-due pending tasks, soonest
+    // first; returns how many were visited
+    template <typename Visitor>
+    size_t next_due(size_t k, Visitor&& visit) const {
+        shared_lock<shared_mutex> lock = lock_with_indexes(PendingDue);
+        return pending_due.top_k(k, [&](TaskId id) { visit(TaskView(tasks, tasks.slot(id))); });
+    }
+
+    // Call visit(TaskView), in list order, for tasks whose description holds
+    // every word of query; "groc*" matches words starting with "groc".
+    // Returns how many tasks matched.
+    template <typename Visitor>
+    size_t search(string_view query, Visitor&& visit) const {
+        ScopedTimer timer(Metrics::Op::Search);
+        shared_lock<shared_mutex> lock = lock_with_indexes(Search);
+        return search_index.search(query, [&](TaskId id) { visit(TaskView(tasks, tasks.slot(id))); });
+    }
+
+    // Total, pending, completed and overdue counts in O(1), from counters
+    // every change keeps current; the lock is only taken exclusively on the
+    // first call after the date changes
+    TaskStats stats() const {
+        int32_t today = today_day_number();
+        {
+            shared_lock<shared_mutex> lock(state_mutex);
+            if ((built_indexes & Counters) && counters.current(today)) {
+                return counters.summary();
+            }
+        }
+        unique_lock<shared_mutex> lock(state_mutex);
+        build_indexes(Counters);
+        counters.advance(today);
+        return counters.summary();
+    }
+
+    // Call visit(day, DayCounts) for each due day between the two that has
+    // tasks, from the same counters as stats()
+    template <typename Visitor>
+    void for_each_due_day(int32_t first_day, int32_t last_day, Visitor&& visit) const {
+        shared_lock<shared_mutex> lock = lock_with_indexes(Counters);
+        counters.for_each_day(first_day, last_day, visit);
+    }
+
+    // Count the tasks matching filter
+    size_t count_tasks(const TaskFilter& filter) const {
+        ScopedTimer timer(Metrics::Op::Count);
+        shared_lock<shared_mutex> lock(state_mutex);
+        size_t chunks = scan_chunks();
+        if (chunks == 1) {
+            return filter.count(tasks);
+        }
+        vector<size_t> counts(chunks);
+        parallel_scan(chunks, [&](size_t chunk, size_t first_word, size_t last_word) {
+            counts[chunk] = filter.count(tasks, first_word, last_word);
+        });
+        size_t total = 0;
+        for (size_t count : counts) {
+            total += count;
+        }
+        return total;
+    }
+
+    // Slots of the tasks matching filter, in list order; slots stay valid
+    // until the next write
+    void select_tasks(const TaskFilter& filter, vector<uint32_t>& selection) const {
+        ScopedTimer timer(Metrics::Op::Select);
+        shared_lock<shared_mutex> lock(state_mutex);
+        select_locked(filter, selection);
+    }
+
+    // View tasks matching a filter; date-bounded views come in due order.
+    // Output is buffered and written to out in large chunks.
+    void view_tasks(const TaskFilter& filter, OutputFormat format = OutputFormat::Text,
+                    ostream& out = cout) const {
+        ScopedTimer timer(Metrics::Op::View);
+        TaskWriter writer(out, format);
+        auto print = [&writer](const TaskView& task) { writer.write(task); };
+        if (filter.has_due_range()) {
+            for_each_due(filter, print);
+            return;
+        }
+        shared_lock<shared_mutex> lock(state_mutex);
+        if (scan_chunks() == 1) {
+            filter.for_each(tasks, print);
+            return;
+        }
+        vector<uint32_t> selection;
+        select_locked(filter, selection);
+        for (uint32_t slot : selection) {
+            print(TaskView(tasks, slot));
+        }
+    }
+
+    // View tasks based on a filter option (all, completed, pending, overdue)
+    void view_tasks(const string& filter_option = "all") const {
+        view_tasks(TaskFilter::from_option(filter_option));
+    }
+
+    // Write the task list and undo/redo history to a binary snapshot.
+    // The file is written beside path, synced and renamed over it. Returns
+    // the journal sequence the snapshot covers, which is durable on return.
+    uint64_t save_snapshot(const string& path) const {
+        uint64_t sequence;
+        OperationJournal* active_journal;
+        {
+            shared_lock<shared_mutex> lock(state_mutex);
+            write_snapshot(path);
+            sequence = applied_sequence;
+            active_journal = journal.get();
+        }
+        if (active_journal) {
+            active_journal->commit(sequence);
+        }
+        return sequence;
+    }
+
+    // Append to image the bytes save_snapshot would write, without touching
+    // the disk. Returns the journal sequence the image covers, which is
+    // durable on return.
+    uint64_t snapshot_image(string& image) const {
+        uint64_t sequence;
+        OperationJournal* active_journal;
+        {
+            shared_lock<shared_mutex> lock(state_mutex);
+            encode_snapshot([&](const char* data, size_t size) { image.append(data, size); });
+            sequence = applied_sequence;
+            active_journal = journal.get();
+        }
+        if (active_journal) {
+            active_journal->commit(sequence);
+        }
+        return sequence;
+    }
+
+    // Replace the current state with a snapshot written by save_snapshot
+    void load_snapshot(const string& path) {
+        unique_lock<shared_mutex> lock(state_mutex);
+        read_snapshot(path);
+    }
+
+    // Journal sequence of the last applied change
+    uint64_t sequence() const {
+        shared_lock<shared_mutex> lock(state_mutex);
+        return applied_sequence;
+    }
+
+    // Append the synced journal records after after_sequence to out, framed
+    // as in the journal file; see OperationJournal::read_feed
+    bool read_changes(uint64_t after_sequence, string& out, size_t max_bytes, uint64_t& last) const {
+        shared_lock<shared_mutex> lock(state_mutex);
+        return require_journal().read_feed(after_sequence, out, max_bytes, last);
+    }
+
+    // Call wake() whenever new changes are readable, until unsubscribed or
+    // the journal is reopened
+    size_t subscribe_changes(function<void()> wake) {
+        shared_lock<shared_mutex> lock(state_mutex);
+        return require_journal().subscribe(move(wake));
+    }
+
+    void unsubscribe_changes(size_t id) {
+        shared_lock<shared_mutex> lock(state_mutex);
+        if (journal) {
+            journal->unsubscribe(id);
+        }
+    }
+
+    // Reject local writes; a replica changes only through apply_replicated
+    void set_read_only(bool read_only) {
+        unique_lock<shared_mutex> lock(state_mutex);
+        this->read_only = read_only;
+    }
+
+    // Apply a change read from a primary's feed. Records already covered
+    // are skipped; a gap in sequence numbers means changes were lost.
+    // Replicas keep no journal of their own.
+    void apply_replicated(const JournalRecord& record) {
+        unique_lock<shared_mutex> lock(state_mutex);
+        if (journal) {
+            throw TaskManagerException("Cannot replicate into a journaled list");
+        }
+        if (record.sequence <= applied_sequence) {
+            return;
+        }
+        if (record.sequence != applied_sequence + 1) {
+            throw TaskManagerException("Replication gap after sequence " + to_string(applied_sequence));
+        }
+        apply_record(record);
+    }
+
+private:
+    // Build the indexes in mask that are not built yet, from the live rows;
+    // the state lock must be held exclusively
+    void build_indexes(uint8_t mask) const {
+        mask &= ~built_indexes;
+        if (mask == 0) {
+            return;
+        }
+        if (mask & DescriptionLookup) {
+            description_index.reserve(tasks.size());
+        }
+        for (uint32_t slot = 0; slot < tasks.slot_count(); ++slot) {
+            if (!tasks.live_at(slot)) {
+                continue;
+            }
+            TaskId id = tasks.id_at(slot);
+            int32_t due_day = tasks.due_day_at(slot);
+            bool completed = tasks.completed_at(slot);
+            if (mask & DescriptionLookup) {
+                description_index.insert(tasks.description_id_at(slot), id);
+            }
+            if (mask & DueDays) {
+                due_index.insert(due_day, id);
+            }
+            if ((mask & PendingDue) && !completed) {
+                pending_due.push(due_day, id);
+            }
+            if (mask & Search) {
+                search_index.insert(tasks.description_at(slot), id);
+            }
+            if (mask & Counters) {
+                counters.insert(due_day, completed);
+            }
+        }
+        built_indexes |= mask;
+    }
+
+    // Take the state lock shared with the indexes in mask built. Building
+    // needs the lock exclusively, which is taken only on first use.
+    shared_lock<shared_mutex> lock_with_indexes(uint8_t mask) const {
+        shared_lock<shared_mutex> lock(state_mutex);
+        while ((built_indexes & mask) != mask) {
+            lock.unlock();
+            {
+                unique_lock<shared_mutex> writer(state_mutex);
+                build_indexes(mask);
+            }
+            lock.lock();
+        }
+        return lock;
+    }
+
+    // Run a mutation under the writer lock, then wait for its journal record
+    // to become durable once the lock is released
+    template <typename Mutation>
+    bool write(Mutation&& mutation) {
+        bool changed;
+        uint64_t sequence;
+        OperationJournal* active_journal;
+        {
+            unique_lock<shared_mutex> lock(state_mutex, defer_lock);
+            {
+                ScopedTimer timer(Metrics::Op::LockWait);
+                lock.lock();
+            }
+            if (read_only) {
+                throw TaskManagerException("Read-only replica");
+            }
+            if (journal && journal->has_failed()) {
+                throw TaskManagerException("Journal failed; checkpoint to make the list durable again");
+            }
+            changed = mutation();
+            sequence = applied_sequence;
+            active_journal = journal.get();
+        }
+        if (active_journal) {
+            {
+                ScopedTimer timer(Metrics::Op::JournalCommit);
+                active_journal->commit(sequence);
+            }
+            if (active_journal->size_bytes() >= active_journal->config().checkpoint_bytes) {
+                unique_lock<shared_mutex> lock(state_mutex);
+                if (journal->size_bytes() >= journal->config().checkpoint_bytes) {
+                    checkpoint_locked();
+                }
+            }
+        }
+        return changed;
+    }
+
+    // Append an operation to the journal once the mutation it describes has
+    // been applied, so a mutation that throws leaves no record behind
+    void journal_operation(JournalOp op, string_view description = {}, int32_t due_day = 0,
+                           bool completed = false) {
+        if (journal) {
+            applied_sequence = journal->append(op, description, due_day, completed);
+        }
+    }
+
+    OperationJournal& require_journal() const {
+        if (!journal) {
+            throw TaskManagerException("No journal is open");
+        }
+        return *journal;
+    }
+
+    void checkpoint_locked() {
+        if (checkpoint_path.empty()) {
+            return;
+        }
+        write_snapshot(checkpoint_path);
+        if (journal) {
+            journal->reset();
+        }
+    }
+
+    // The apply_* mutations run with the state lock held exclusively (or
+    // during recovery) and journal themselves after changing the state
+
+    bool apply_add(const Task& task) {
+        int32_t due_day = to_day_number(task.due_date);
+        begin_unit();
+        add_unlogged(task.description, task.completed, due_day);
+        journal_operation(JournalOp::Add, task.description, due_day, task.completed);
+        Logger::info("Task added: ", task.description);
+        return true;
+    }
+
+    bool apply_complete(string_view description) {
+        TaskId id = find_pending(description);
+        if (id != TaskStore::npos) {
+            begin_unit();
+            complete_unlogged(id);
+            journal_operation(JournalOp::Complete, description);
+            Logger::info("Task marked as completed: ", description);
+            return true;
+        }
+        Logger::debug("Task not found or already completed: ", description);
+        return false;
+    }
+
+    bool apply_delete(string_view description) {
+        TaskId id = find_task(description);
+        if (id != TaskStore::npos) {
+            begin_unit();
+            delete_unlogged(id);
+            journal_operation(JournalOp::Delete, description);
+            Logger::info("Task deleted: ", description);
+            return true;
+        }
+        Logger::debug("Task not found: ", description);
+        return false;
+    }
+
+    size_t apply_complete_matching(TaskFilter filter) {
+        filter.status(TaskFilter::Status::Pending);
+        vector<uint32_t> selection;
+        select_locked(filter, selection);
+        if (selection.empty()) {
+            Logger::debug("No pending tasks matched");
+            return 0;
+        }
+        undo_log.reserve(undo_log.size() + selection.size());
+        begin_unit();
+        for (uint32_t slot : selection) {
+            complete_unlogged(tasks.id_at(slot));
+        }
+        journal_operation(JournalOp::CompleteMatching, journal ? filter.encode() : string());
+        Logger::info("Tasks marked as completed: ", selection.size());
+        return selection.size();
+    }
+
+    // Chunks to split a scan of the store into; 1 means scan serially
+    size_t scan_chunks() const {
+        if (parallel.threads == 1 || tasks.size() < parallel.serial_below) {
+            return 1;
+        }
+        size_t threads = parallel.threads ? parallel.threads : ThreadPool::shared().concurrency();
+        return max<size_t>(1, min(threads, TaskFilter::word_count(tasks)));
+    }
+
+    // Run body(chunk, first_word, last_word) over chunks even word ranges
+    // of the store on the shared pool
+    template <typename Body>
+    void parallel_scan(size_t chunks, Body&& body) const {
+        size_t words = TaskFilter::word_count(tasks);
+        ThreadPool::shared().parallel_for(chunks, [&](size_t chunk) {
+            body(chunk, words * chunk / chunks, words * (chunk + 1) / chunks);
+        });
+    }
+
+    // Filter into a selection vector; chunks are joined in order, so the
+    // result matches a serial scan
+    void select_locked(const TaskFilter& filter, vector<uint32_t>& selection) const {
+        size_t chunks = scan_chunks();
+        if (chunks == 1) {
+            filter.select(tasks, selection);
+            return;
+        }
+        vector<vector<uint32_t>> parts(chunks);
+        parallel_scan(chunks, [&](size_t chunk, size_t first_word, size_t last_word) {
+            filter.for_each_slot(tasks, first_word, last_word,
+                [&](uint32_t slot) { parts[chunk].push_back(slot); });
+        });
+        for (const auto& part : parts) {
+            selection.insert(selection.end(), part.begin(), part.end());
+        }
+    }
+
+    BatchResult apply_batch_locked(const TaskCommand* commands, size_t count, bool* applied, bool step_each) {
+        BatchResult result;
+        if (count == 0) {
+            return result;
+        }
+        size_t adds = 0;
+        for (size_t i = 0; i < count; ++i) {
+            adds += commands[i].kind == TaskCommand::Kind::Add;
+        }
+        // Columns hold tombstoned rows too; the index holds live tasks only
+        tasks.reserve(tasks.slot_count() + adds);
+        if (built_indexes & DescriptionLookup) {
+            description_index.reserve(tasks.size() + adds);
+        }
+        undo_log.reserve(undo_log.size() + count);
+
+        begin_unit();
+        for (size_t i = 0; i < count; ++i) {
+            const TaskCommand& command = commands[i];
+            TaskId id = TaskStore::npos;
+            if (step_each) {
+                begin_unit();
+            }
+            switch (command.kind) {
+                case TaskCommand::Kind::Add:
+                    add_unlogged(command.description, false, command.due_day);
+                    ++result.added;
+                    break;
+                case TaskCommand::Kind::Complete:
+                    id = find_pending(command.description);
+                    if (id != TaskStore::npos) {
+                        complete_unlogged(id);
+                        ++result.completed;
+                    }
+                    break;
+                case TaskCommand::Kind::Delete:
+                    id = find_task(command.description);
+                    if (id != TaskStore::npos) {
+                        delete_unlogged(id);
+                        ++result.deleted;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            bool took_effect = command.kind == TaskCommand::Kind::Add || id != TaskStore::npos;
+            result.failed += !took_effect;
+            if (applied) {
+                applied[i] = took_effect;
+            }
+        }
+        starting_unit = false;
+        journal_operation(step_each ? JournalOp::Pipeline : JournalOp::Batch,
+            journal ? encode_batch(commands, count) : string());
+        Logger::info("Batch applied: ", result.added, " added, ", result.completed, " completed, ",
+            result.deleted, " deleted, ", result.failed, " failed");
+        return result;
+    }
+
+    // Revert the newest unit of changes, newest change first
+    bool apply_undo() {
+        if (undo_log.empty()) {
+            Logger::debug("Undo not possible");
+            return false;
+        }
+        vector<TaskChange> reverted;
+        bool unit_start;
+        do {
+            TaskChange change = undo_log.back();
+            undo_log.pop_back();
+            unit_start = change.unit_start;
+            revert_change(change);
+            redo_log.push_back(change);
+            if (journal) {
+                reverted.push_back(change);
+            }
+        } while (!unit_start && !undo_log.empty());
+        tasks.restore_order();
+        journal_operation(JournalOp::Undo, encode_changes(reverted));
+        Logger::info("Undo completed");
+        return true;
+    }
+
+    // Re-apply the most recently undone unit, oldest change first
+    bool apply_redo() {
+        if (redo_log.empty()) {
+            Logger::debug("Redo not possible");
+            return false;
+        }
+        vector<TaskChange> reapplied;
+        bool deleted = false;
+        do {
+            TaskChange change = redo_log.back();
+            redo_log.pop_back();
+            reapply_change(change);
+            deleted |= change.kind == TaskChange::Kind::Delete;
+            undo_log.push_back(change);
+            if (journal) {
+                reapplied.push_back(change);
+            }
+        } while (!redo_log.empty() && !redo_log.back().unit_start);
+        tasks.restore_order();
+        journal_operation(JournalOp::Redo, encode_changes(reapplied));
+        Logger::info(deleted ? "Redo completed (Task deleted)" : "Redo completed");
+        return true;
+    }
+
+    // State changes shared by single operations and batches; callers
+    // journal, log and open the undo unit
+
+    void add_unlogged(string_view description, bool completed, int32_t due_day) {
+        TaskId id = tasks.add(description, completed, due_day);
+        if (built_indexes & DescriptionLookup) {
+            description_index.insert(tasks.description_id_at(tasks.slot(id)), id);
+        }
+        if (built_indexes & DueDays) {
+            due_index.insert(due_day, id);
+        }
+        if (built_indexes & Search) {
+            search_index.insert(description, id);
+        }
+        if (built_indexes & Counters) {
+            counters.insert(due_day, completed);
+        }
+        if ((built_indexes & PendingDue) && !completed) {
+            pending_due.push(due_day, id);
+        }
+        record_change(TaskChange::of(TaskChange::Kind::Add, id));
+    }
+
+    void complete_unlogged(TaskId id) {
+        set_row_completed(id, true);
+        record_change(TaskChange::of(TaskChange::Kind::Complete, id));
+    }
+
+    void delete_unlogged(TaskId id) {
+        TaskChange change = TaskChange::of(TaskChange::Kind::Delete, id);
+        remove_row(change);
+        record_change(change);
+    }
+
+    // Mark the next recorded change as the start of a new undo unit
+    void begin_unit() {
+        starting_unit = true;
+    }
+
+    // Push a change onto the undo log; a new change invalidates redo
+    void record_change(TaskChange change) {
+        change.unit_start = starting_unit;
+        starting_unit = false;
+        undo_log.push_back(change);
+        redo_log.clear();
+    }
+
+    // Undo one change; a row taken out of the store is saved in change
+    void revert_change(TaskChange& change) {
+        switch (change.kind) {
+            case TaskChange::Kind::Add:
+                remove_row(change);
+                break;
+            case TaskChange::Kind::Delete:
+                insert_row(change);
+                break;
+            case TaskChange::Kind::Complete:
+                set_row_completed(change.id, false);
+                break;
+        }
+    }
+
+    // Redo one undone change; a row taken out of the store is saved in change
+    void reapply_change(TaskChange& change) {
+        switch (change.kind) {
+            case TaskChange::Kind::Add:
+                insert_row(change);
+                break;
+            case TaskChange::Kind::Delete:
+                remove_row(change);
+                break;
+            case TaskChange::Kind::Complete:
+                set_row_completed(change.id, true);
+                break;
+        }
+    }
+
+    // Encode the changes an undo or redo applied, in order, as (uint8_t
+    // flags, uint32_t id) plus, for adds and deletes, (uint32_t slot,
+    // int32_t due_day, uint32_t length, description bytes). The record
+    // then replays without the history, which a recovered or replica list
+    // may only hold in part.
+    string encode_changes(const vector<TaskChange>& changes) const {
+        string out;
+        for (const TaskChange& change : changes) {
+            uint8_t flags = static_cast<uint8_t>(change.kind) | (change.unit_start ? 4 : 0)
+                | (change.completed ? 8 : 0);
+            out += static_cast<char>(flags);
+            out.append(reinterpret_cast<const char*>(&change.id), sizeof(change.id));
+            if (change.kind != TaskChange::Kind::Complete) {
+                string_view text = tasks.description_text(change.description);
+                uint32_t length = static_cast<uint32_t>(text.size());
+                out.append(reinterpret_cast<const char*>(&change.slot), sizeof(change.slot));
+                out.append(reinterpret_cast<const char*>(&change.due_day), sizeof(change.due_day));
+                out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+                out.append(text.data(), text.size());
+            }
+        }
+        return out;
+    }
+
+    // Decode an encode_changes payload, interning the descriptions
+    vector<TaskChange> decode_changes(string_view payload) {
+        vector<TaskChange> changes;
+        size_t offset = 0;
+        while (offset < payload.size()) {
+            if (payload.size() - offset < 5) {
+                throw TaskManagerException("Corrupt undo record");
+            }
+            uint8_t flags = static_cast<uint8_t>(payload[offset]);
+            TaskChange change = TaskChange::of(static_cast<TaskChange::Kind>(flags & 3), 0);
+            change.unit_start = (flags & 4) != 0;
+            change.completed = (flags & 8) != 0;
+            memcpy(&change.id, payload.data() + offset + 1, sizeof(change.id));
+            offset += 5;
+            if (change.kind != TaskChange::Kind::Complete) {
+                uint32_t length;
+                if (payload.size() - offset < 12) {
+                    throw TaskManagerException("Corrupt undo record");
+                }
+                memcpy(&change.slot, payload.data() + offset, sizeof(change.slot));
+                memcpy(&change.due_day, payload.data() + offset + 4, sizeof(change.due_day));
+                memcpy(&length, payload.data() + offset + 8, sizeof(length));
+                offset += 12;
+                if (length > payload.size() - offset) {
+                    throw TaskManagerException("Corrupt undo record");
+                }
+                change.description = tasks.intern_description(payload.substr(offset, length));
+                offset += length;
+            }
+            changes.push_back(change);
+        }
+        return changes;
+    }
+
+    // Replay a recorded undo or redo from its changes. The history is
+    // moved along as far as it reaches; entries spilled before a
+    // checkpoint, or older than a replica's snapshot, are simply absent.
+    // Records from older journals carry no changes and replay the history.
+    void replay_history(const JournalRecord& record) {
+        bool undo = record.op == JournalOp::Undo;
+        if (record.description.empty()) {
+            undo ? apply_undo() : apply_redo();
+            return;
+        }
+        ChangeHistory& from = undo ? undo_log : redo_log;
+        ChangeHistory& to = undo ? redo_log : undo_log;
+        for (TaskChange change : decode_changes(record.description)) {
+            if (!from.empty()) {
+                from.pop_back();
+            }
+            undo ? revert_change(change) : reapply_change(change);
+            to.push_back(change);
+        }
+        tasks.restore_order();
+    }
+
+    // Take a task's row out of the store, saving it in change
+    void remove_row(TaskChange& change) {
+        uint32_t slot = tasks.slot(change.id);
+        change.slot = slot;
+        change.description = tasks.description_id_at(slot);
+        change.completed = tasks.completed_at(slot);
+        change.due_day = tasks.due_day_at(slot);
+        if (built_indexes & DescriptionLookup) {
+            description_index.erase(change.description, change.id);
+        }
+        if (built_indexes & DueDays) {
+            due_index.erase(change.due_day, change.id);
+        }
+        if (built_indexes & PendingDue) {
+            pending_due.erase(change.id);
+        }
+        if (built_indexes & Search) {
+            search_index.erase(tasks.description_at(slot), change.id);
+        }
+        if (built_indexes & Counters) {
+            counters.erase(change.due_day, change.completed);
+        }
+        tasks.erase(slot);
+    }
+
+    // Put a row saved by remove_row back where it was; usually this revives
+    // its tombstone in place. Callers restore the store's order afterwards.
+    void insert_row(const TaskChange& change) {
+        tasks.insert(change.id, change.description, change.completed, change.due_day);
+        if (built_indexes & DescriptionLookup) {
+            description_index.insert_ordered(change.description, change.id);
+        }
+        if (built_indexes & DueDays) {
+            due_index.insert(change.due_day, change.id);
+        }
+        if (built_indexes & Search) {
+            search_index.insert(tasks.description_text(change.description), change.id);
+        }
+        if (built_indexes & Counters) {
+            counters.insert(change.due_day, change.completed);
+        }
+        if ((built_indexes & PendingDue) && !change.completed) {
+            pending_due.push(change.due_day, change.id);
+        }
+    }
+
+    // Flip a task's status, keeping the pending heap and counters in step
+    void set_row_completed(TaskId id, bool completed) {
+        uint32_t slot = tasks.slot(id);
+        if (tasks.completed_at(slot) == completed) {
+            return;
+        }
+        tasks.set_completed(slot, completed);
+        if (built_indexes & Counters) {
+            counters.set_completed(tasks.due_day_at(slot), completed);
+        }
+        if (!(built_indexes & PendingDue)) {
+            return;
+        }
+        if (completed) {
+            pending_due.erase(id);
+        } else {
+            pending_due.push(tasks.due_day_at(slot), id);
+        }
+    }
+
+    // First task in list order with this description, pending or not
+    TaskId find_task(string_view description) {
+        build_indexes(DescriptionLookup);
+        return description_index.find(tasks.find_description(description), [](TaskId) { return true; });
+    }
+
+    TaskId find_pending(string_view description) {
+        build_indexes(DescriptionLookup);
+        return description_index.find(tasks.find_description(description),
+            [this](TaskId candidate) { return !tasks.completed_at(tasks.slot(candidate)); });
+    }
+
+    // Re-apply one recovered journal record (the journal is closed meanwhile)
+    void apply_record(const JournalRecord& record) {
+        switch (record.op) {
+            case JournalOp::Add: {
+                TaskBuilder builder(record.description);
+                builder.set_due_date(from_day_number(record.due_day)).set_completed(record.completed);
+                apply_add(builder.build());
+                break;
+            }
+            case JournalOp::Complete:
+                apply_complete(record.description);
+                break;
+            case JournalOp::Delete:
+                apply_delete(record.description);
+                break;
+            case JournalOp::Undo:
+            case JournalOp::Redo:
+                replay_history(record);
+                break;
+            case JournalOp::Batch: {
+                vector<TaskCommand> commands = decode_batch(record.description);
+                apply_batch_locked(commands.data(), commands.size(), nullptr, false);
+                break;
+            }
+            case JournalOp::Pipeline: {
+                vector<TaskCommand> commands = decode_batch(record.description);
+                apply_batch_locked(commands.data(), commands.size(), nullptr, true);
+                break;
+            }
+            case JournalOp::CompleteMatching:
+                apply_complete_matching(TaskFilter::decode(record.description));
+                break;
+        }
+        applied_sequence = record.sequence;
+    }
+
+    // Encode the task list and history as a snapshot file's bytes, passing
+    // them to sink(data, size) in order
+    template <typename Sink>
+    void encode_snapshot(Sink&& sink) const {
+        // Each interned description is written to the string table once
+        string strings;
+        vector<SnapshotString> written(tasks.description_count(), SnapshotString{0, UINT32_MAX});
+        auto add_string = [&](DescriptionId description) {
+            SnapshotString& ref = written[description];
+            if (ref.length == UINT32_MAX) {
+                string_view text = tasks.description_text(description);
+                ref = {static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(text.size())};
+                strings.append(text.data(), text.size());
+            }
+            return ref;
+        };
+        // Only live rows are written. Without tombstones the columns are
+        // written as they are; otherwise live rows are gathered first.
+        vector<SnapshotString> descriptions;
+        descriptions.reserve(tasks.size());
+        vector<TaskId> live_ids;
+        vector<uint64_t> live_words;
+        vector<int32_t> live_days;
+        if (tasks.dead_count() > 0) {
+            live_ids.reserve(tasks.size());
+            live_days.reserve(tasks.size());
+            live_words.assign((tasks.size() + 63) / 64, 0);
+        }
+        tasks.for_each_live_slot([&](uint32_t slot) {
+            if (tasks.dead_count() > 0) {
+                size_t row = live_ids.size();
+                if (tasks.completed_at(slot)) {
+                    live_words[row / 64] |= uint64_t(1) << (row % 64);
+                }
+                live_ids.push_back(tasks.id_at(slot));
+                live_days.push_back(tasks.due_day_at(slot));
+            }
+            descriptions.push_back(add_string(tasks.description_id_at(slot)));
+        });
+        bool gathered = tasks.dead_count() > 0;
+        const TaskId* ids = gathered ? live_ids.data() : tasks.id_column().data();
+        const uint64_t* words = gathered ? live_words.data() : tasks.completed_words().data();
+        const int32_t* days = gathered ? live_days.data() : tasks.due_day_column().data();
+        auto to_records = [&add_string](const vector<TaskChange>& changes) {
+            vector<SnapshotChange> records;
+            records.reserve(changes.size());
+            for (const auto& change : changes) {
+                records.push_back({static_cast<uint8_t>(change.kind), change.unit_start ? uint8_t(1) : uint8_t(0),
+                    change.completed ? uint8_t(1) : uint8_t(0), 0, change.id, change.slot, change.due_day,
+                    add_string(change.description)});
+            }
+            return records;
+        };
+        vector<SnapshotChange> undo_records = to_records(undo_log.resident_changes());
+        vector<SnapshotChange> redo_records = to_records(redo_log.resident_changes());
+
+        SnapshotHeader header = {};
+        memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+        header.version = snapshot_version;
+        header.task_count = tasks.size();
+        header.next_id = tasks.next_id();
+        header.undo_count = undo_records.size();
+        header.redo_count = redo_records.size();
+        header.string_table_size = strings.size();
+        header.journal_sequence = applied_sequence;
+
+        // A compressed snapshot is encoded from the whole image at once
+        bool compressed = snapshot_format == SnapshotFormat::Compressed;
+        string image;
+        auto write_section = [&](const void* data, size_t size) {
+            static const char padding[8] = {};
+            if (compressed) {
+                image.append(static_cast<const char*>(data), size);
+                image.append(padding, snapshot_align(size) - size);
+                return;
+            }
+            sink(static_cast<const char*>(data), size);
+            sink(padding, snapshot_align(size) - size);
+        };
+        write_section(&header, sizeof(header));
+        write_section(ids, tasks.size() * sizeof(TaskId));
+        write_section(words, (tasks.size() + 63) / 64 * sizeof(uint64_t));
+        write_section(days, tasks.size() * sizeof(int32_t));
+        write_section(descriptions.data(), descriptions.size() * sizeof(SnapshotString));
+        write_section(undo_records.data(), undo_records.size() * sizeof(SnapshotChange));
+        write_section(redo_records.data(), redo_records.size() * sizeof(SnapshotChange));
+        write_section(strings.data(), strings.size());
+        if (compressed) {
+            string encoded = SnapshotCodec::encode(image);
+            sink(encoded.data(), encoded.size());
+        }
+    }
+
+    void write_snapshot(const string& path) const {
+        string temp_path = path + ".tmp";
+        ofstream out(temp_path, ios::binary | ios::trunc);
+        if (!out) {
+            throw TaskManagerException("Cannot write snapshot " + temp_path);
+        }
+        encode_snapshot([&](const char* data, size_t size) { out.write(data, size); });
+        out.close();
+        if (!out) {
+            throw TaskManagerException("Cannot write snapshot " + temp_path);
+        }
+        sync_file(temp_path);
+        filesystem::rename(temp_path, path);
+        sync_parent_directory(path);
+        Logger::info("Snapshot saved: ", tasks.size(), " tasks");
+    }
+
+    void read_snapshot(const string& path) {
+        auto file = make_shared<MappedFile>(path);
+        shared_ptr<const void> backing = file;
+        const char* base = file->data();
+        size_t size = file->size();
+        if (SnapshotCodec::is_compressed(base, size)) {
+            auto image = make_shared<string>(SnapshotCodec::decode(base, size));
+            backing = image;
+            base = image->data();
+            size = image->size();
+        }
+        size_t offset = 0;
+        auto section = [&](uint64_t bytes) {
+            if (bytes > size - offset) {
+                throw TaskManagerException("Corrupt snapshot: " + path);
+            }
+            const char* start = base + offset;
+            offset = min(size, offset + snapshot_align(static_cast<size_t>(bytes)));
+            return start;
+        };
+
+        SnapshotHeader header = {};
+        memcpy(&header, section(snapshot_v1_header_size), snapshot_v1_header_size);
+        if (memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0) {
+            throw TaskManagerException("Not a task snapshot: " + path);
+        }
+        if (header.version >= 2) {
+            memcpy(&header.journal_sequence, section(sizeof(header.journal_sequence)),
+                sizeof(header.journal_sequence));
+        }
+        if (header.version < 1 || header.version > snapshot_version) {
+            throw TaskManagerException("Unsupported snapshot version " + to_string(header.version));
+        }
+        if (header.task_count > header.next_id || header.next_id > TaskStore::npos) {
+            throw TaskManagerException("Corrupt snapshot: " + path);
+        }
+        size_t count = static_cast<size_t>(header.task_count);
+        auto ids = reinterpret_cast<const TaskId*>(section(count * sizeof(TaskId)));
+        auto words = reinterpret_cast<const uint64_t*>(section((count + 63) / 64 * sizeof(uint64_t)));
+        auto days = reinterpret_cast<const int32_t*>(section(count * sizeof(int32_t)));
+        auto refs = reinterpret_cast<const SnapshotString*>(section(count * sizeof(SnapshotString)));
+        size_t record_size = header.version >= 3 ? sizeof(SnapshotChange) : snapshot_v2_memento_size;
+        auto undo_records = reinterpret_cast<const SnapshotChange*>(section(header.undo_count * record_size));
+        auto redo_records = reinterpret_cast<const SnapshotChange*>(section(header.redo_count * record_size));
+        if (header.version < 3) {
+            header.undo_count = 0;
+            header.redo_count = 0;
+        }
+        const char* strings = section(header.string_table_size);
+
+        auto resolve = [&](const SnapshotString& ref) {
+            if (uint64_t(ref.offset) + ref.length > header.string_table_size) {
+                throw TaskManagerException("Corrupt snapshot: " + path);
+            }
+            return string_view(strings + ref.offset, ref.length);
+        };
+        // Descriptions view the mapped file or decompressed image, which
+        // the pool keeps alive
+        DescriptionPool pool;
+        pool.retain(backing);
+        pool.reserve(count);
+        vector<DescriptionId> descriptions(count);
+        for (size_t slot = 0; slot < count; ++slot) {
+            descriptions[slot] = pool.adopt(resolve(refs[slot]));
+        }
+        auto to_log = [&](const SnapshotChange* records, uint64_t record_count) {
+            vector<TaskChange> changes;
+            changes.reserve(static_cast<size_t>(record_count));
+            for (uint64_t i = 0; i < record_count; ++i) {
+                const SnapshotChange& record = records[i];
+                if (record.kind < 1 || record.kind > 3 || record.id >= header.next_id) {
+                    throw TaskManagerException("Corrupt snapshot: " + path);
+                }
+                TaskChange change{static_cast<TaskChange::Kind>(record.kind), record.unit_start != 0,
+                    record.completed != 0, record.id, record.slot, record.due_day, pool.adopt(resolve(record.description))};
+                changes.push_back(change);
+            }
+            return changes;
+        };
+        vector<TaskChange> loaded_undo = to_log(undo_records, header.undo_count);
+        vector<TaskChange> loaded_redo = to_log(redo_records, header.redo_count);
+
+        tasks.restore(count, static_cast<TaskId>(header.next_id), ids, words, days,
+            move(descriptions), move(pool));
+        // The indexes are rebuilt on first use, so a load that is only
+        // viewed, exported or checkpointed never pays for them
+        description_index.clear();
+        due_index.clear();
+        pending_due.clear();
+        search_index.clear();
+        counters.clear();
+        built_indexes = 0;
+        undo_log.assign(move(loaded_undo));
+        redo_log.assign(move(loaded_redo));
+        starting_unit = false;
+        applied_sequence = header.journal_sequence;
+        Logger::info("Snapshot loaded: ", tasks.size(), " tasks");
+    }
+};
+
+// Many independent task lists in one process, keyed by user or list id.
+// Each list is its own TodoListManager, with its own lock, indexes, journal
+// and snapshot under directory, so operations on different lists never
+// contend past the short shard lookup. Ids hash to shards; each shard keeps
+// at most its share of max_resident lists loaded and, past that, evicts the
+// least recently used list nobody holds by checkpointing it to its snapshot.
+// A later acquire reloads it.
+class ShardedTodoManager {
+public:
+    struct Options {
+        string directory = "todo_lists";
+        size_t shard_count = 64;
+        size_t max_resident = 4096;                     // loaded lists, across all shards
+        OperationJournal::Options journal;
+        SnapshotFormat snapshot_format = SnapshotFormat::Mapped;
+    };
+
+private:
+    struct Resident {
+        shared_ptr<TodoListManager> manager;
+        uint64_t last_used = 0;
+    };
+
+    struct Shard {
+        mutex lock;
+        unordered_map<string, Resident> lists;
+        unordered_map<string, shared_ptr<TodoListManager>> evicting;   // detached, being checkpointed
+        uint64_t clock = 0;
+    };
+
+    using Evicted = vector<pair<string, shared_ptr<TodoListManager>>>;
+
+    Options options;
+    vector<unique_ptr<Shard>> shards;
+    size_t shard_capacity;
+
+    Shard& shard_of(string_view id) {
+        return *shards[hash<string_view>()(id) % shards.size()];
+    }
+
+    // File name stem for a list id: letters, digits, '-' and '_' as they
+    // are, every other byte as %XX, so any id maps to one safe file name
+    string path_stem(string_view id) const {
+        static const char hex[] = "0123456789ABCDEF";
+        string stem = options.directory + "/";
+        for (unsigned char c : id) {
+            if (isalnum(c) || c == '-' || c == '_') {
+                stem += static_cast<char>(c);
+            } else {
+                stem += '%';
+                stem += hex[c >> 4];
+                stem += hex[c & 15];
+            }
+        }
+        return stem;
+    }
+
+    // Detach an idle list for finish_evictions to checkpoint. It stays in
+    // evicting meanwhile, so acquire takes it back instead of loading a
+    // second copy from files that are still being written.
+    void detach(Shard& shard, unordered_map<string, Resident>::iterator it, Evicted& evicted) {
+        shard.evicting[it->first] = it->second.manager;
+        evicted.emplace_back(it->first, move(it->second.manager));
+        shard.lists.erase(it);
+    }
+
+    // Detach idle lists, least recently used first, until the shard has
+    // room for one more; the shard lock must be held
+    void make_room(Shard& shard, Evicted& evicted) {
+        while (shard.lists.size() >= shard_capacity) {
+            auto victim = shard.lists.end();
+            for (auto it = shard.lists.begin(); it != shard.lists.end(); ++it) {
+                if (it->second.manager.use_count() == 1
+                    && (victim == shard.lists.end() || it->second.last_used < victim->second.last_used)) {
+                    victim = it;
+                }
+            }
+            if (victim == shard.lists.end()) {
+                return;    // every list is in use; go over capacity for now
+            }
+            detach(shard, victim, evicted);
+        }
+    }
+
+    // Checkpoint detached lists without the shard lock, then forget them.
+    // A list acquired again meanwhile is left resident. One whose
+    // checkpoint fails is put back, as its journal may not hold every
+    // change.
+    void finish_evictions(Shard& shard, Evicted& evicted) {
+        for (auto& entry : evicted) {
+            bool saved = true;
+            try {
+                entry.second->checkpoint();
+            } catch (const exception& ex) {
+                Logger::error("Checkpoint of list ", entry.first, " failed: ", ex.what());
+                saved = false;
+            }
+            lock_guard<mutex> lock(shard.lock);
+            auto it = shard.evicting.find(entry.first);
+            if (it == shard.evicting.end() || it->second != entry.second) {
+                continue;
+            }
+            if (!saved) {
+                shard.lists.emplace(entry.first, Resident{entry.second, shard.clock});
+            }
+            shard.evicting.erase(it);
+        }
+        evicted.clear();
+    }
+
+    // The resident list for id, taken back from evicting or loaded; the
+    // shard lock must be held
+    shared_ptr<TodoListManager> find_or_load(Shard& shard, string_view id, Evicted& evicted) {
+        string key(id);
+        auto it = shard.lists.find(key);
+        if (it == shard.lists.end()) {
+            make_room(shard, evicted);
+            auto detached = shard.evicting.find(key);
+            if (detached != shard.evicting.end()) {
+                it = shard.lists.emplace(key, Resident{move(detached->second), 0}).first;
+                shard.evicting.erase(detached);
+            } else {
+                auto manager = make_shared<TodoListManager>();
+                manager->set_snapshot_format(options.snapshot_format);
+                string stem = path_stem(id);
+                manager->open_journal(stem + ".journal", stem + ".snapshot", options.journal);
+                it = shard.lists.emplace(move(key), Resident{move(manager), 0}).first;
+            }
+        }
+        it->second.last_used = ++shard.clock;
+        return it->second.manager;
+    }
+
+public:
+    ShardedTodoManager() : ShardedTodoManager(Options()) {}
+
+    explicit ShardedTodoManager(const Options& sharding)
+        : options(sharding), shard_capacity(max<size_t>(1, sharding.max_resident / max<size_t>(1, sharding.shard_count))) {
+        filesystem::create_directories(options.directory);
+        shards.resize(max<size_t>(1, options.shard_count));
+        for (auto& shard : shards) {
+            shard.reset(new Shard());
+        }
+    }
+
+    ShardedTodoManager(const ShardedTodoManager&) = delete;
+    ShardedTodoManager& operator=(const ShardedTodoManager&) = delete;
+
+    // Checkpoint every loaded list so the next start replays no journal
+    ~ShardedTodoManager() {
+        try {
+            checkpoint_all();
+        } catch (const exception& ex) {
+            Logger::error("Checkpoint failed: ", ex.what());
+        }
+    }
+
+    // The list for id, loaded from its snapshot and journal if it is not
+    // resident. The list is not evicted while the pointer is held. Lists
+    // evicted to make room are checkpointed after the shard lock is
+    // released.
+    shared_ptr<TodoListManager> acquire(string_view id) {
+        Shard& shard = shard_of(id);
+        Evicted evicted;
+        shared_ptr<TodoListManager> manager;
+        try {
+            lock_guard<mutex> lock(shard.lock);
+            manager = find_or_load(shard, id, evicted);
+        } catch (...) {
+            finish_evictions(shard, evicted);
+            throw;
+        }
+        finish_evictions(shard, evicted);
+        return manager;
+    }
+
+    // Run operation(TodoListManager&) on the list for id and return its result
+    template <typename Operation>
+    auto with_list(string_view id, Operation&& operation) {
+        shared_ptr<TodoListManager> manager = acquire(id);
+        return operation(*manager);
+    }
+
+    // Number of lists currently loaded
+    size_t resident_count() const {
+        size_t resident = 0;
+        for (const auto& shard : shards) {
+            lock_guard<mutex> lock(shard->lock);
+            resident += shard->lists.size();
+        }
+        return resident;
+    }
+
+    // Checkpoint and drop every list that is not in use; returns how many
+    size_t evict_idle() {
+        size_t count = 0;
+        for (auto& shard : shards) {
+            Evicted evicted;
+            {
+                lock_guard<mutex> lock(shard->lock);
+                for (auto it = shard->lists.begin(); it != shard->lists.end();) {
+                    auto following = next(it);
+                    if (it->second.manager.use_count() == 1) {
+                        detach(*shard, it, evicted);
+                    }
+                    it = following;
+                }
+            }
+            count += evicted.size();
+            finish_evictions(*shard, evicted);
+        }
+        return count;
+    }
+
+    // Checkpoint every loaded list; the shard lock is only held to list them
+    void checkpoint_all() {
+        for (auto& shard : shards) {
+            vector<shared_ptr<TodoListManager>> lists;
+            {
+                lock_guard<mutex> lock(shard->lock);
+                for (auto& entry : shard->lists) {
+                    lists.push_back(entry.second.manager);
+                }
+            }
+            for (auto& list : lists) {
+                list->checkpoint();
+            }
+        }
+    }
+};
+
+// Path of the platform's null device
+inline const char* null_device() {
+#ifdef _WIN32
+    return "NUL";
+#else
+    return "/dev/null";
+#endif
+}
+
+// Read-scaling stress test: filter scans from 1..N reader threads while one
+// writer keeps adding and deleting tasks. Prints scans and tasks per second.
+int run_read_stress(size_t task_count, double seconds_per_step) {
+    Logger::Config log_config;
+    log_config.file_path = null_device();
+    log_config.overflow_policy = Logger::OverflowPolicy::DropNewest;
+    Logger::configure(log_config);
+
+    // Each reader scans serially; this measures scaling across readers
+    TodoListManager manager;
+    ParallelOptions serial;
+    serial.threads = 1;
+    manager.set_parallelism(serial);
+    TaskBuilder builder;
+    for (size_t i = 0; i < task_count; ++i) {
+        manager.add_task(builder.reset("task " + to_string(i))
+            .set_due_date(from_day_number(static_cast<int32_t>(19000 + i % 365))).build());
+        if (i % 3 == 0) {
+            manager.mark_completed("task " + to_string(i));
+        }
+    }
+
+    unsigned max_readers = max(1u, thread::hardware_concurrency());
+    cout << "tasks=" << task_count << " step=" << seconds_per_step << "s\n";
+    cout << "readers  scans/s      tasks/s        writes/s\n";
+    for (unsigned readers = 1; readers <= max_readers; readers = readers < max_readers ? min(readers * 2, max_readers) : readers + 1) {
+        atomic<bool> running{true};
+        atomic<uint64_t> scans{0};
+        atomic<uint64_t> writes{0};
+        atomic<uint64_t> matched{0};
+        vector<thread> threads;
+        TaskFilter pending = TaskFilter().status(TaskFilter::Status::Pending);
+        for (unsigned r = 0; r < readers; ++r) {
+            threads.emplace_back([&] {
+                uint64_t local = 0;
+                uint64_t found = 0;
+                while (running.load(memory_order_relaxed)) {
+                    found += manager.count_tasks(pending);
+                    ++local;
+                }
+                scans.fetch_add(local);
+                matched.fetch_add(found);
+            });
+        }
+        threads.emplace_back([&] {
+            uint64_t local = 0;
+            while (running.load(memory_order_relaxed)) {
+                manager.add_task(TaskBuilder("stress write").build());
+                manager.delete_task("stress write");
+                local += 2;
+                this_thread::sleep_for(chrono::microseconds(100));
+            }
+            writes.fetch_add(local);
+        });
+        this_thread::sleep_for(chrono::duration<double>(seconds_per_step));
+        running = false;
+        for (auto& worker : threads) {
+            worker.join();
+        }
+        double scan_rate = scans.load() / seconds_per_step;
+        cout << setw(7) << readers << "  " << setw(11) << fixed << setprecision(0) << scan_rate
+             << "  " << setw(13) << scan_rate * task_count
+             << "  " << setw(8) << writes.load() / seconds_per_step << "\n";
+    }
+    return EXIT_SUCCESS;
+}
+
+// Multi-tenant scaling test: 1..N threads each working on their own lists
+// of a ShardedTodoManager capped at a quarter of the lists resident. Picks
+// are skewed towards low ids (the square of a uniform draw), so a hot set
+// stays loaded while the tail keeps being evicted and reloaded. Prints
+// operations per second.
+int run_tenant_stress(size_t list_count, double seconds_per_step) {
+    Logger::Config log_config;
+    log_config.file_path = null_device();
+    log_config.overflow_policy = Logger::OverflowPolicy::DropNewest;
+    Logger::configure(log_config);
+
+    string directory = (filesystem::temp_directory_path() / "todo_tenant_stress").string();
+    filesystem::remove_all(directory);
+    unsigned max_threads = max(1u, thread::hardware_concurrency());
+    cout << "lists=" << list_count << " step=" << seconds_per_step << "s\n";
+    cout << "threads  ops/s        resident\n";
+    for (unsigned workers = 1; workers <= max_threads; workers = workers < max_threads ? min(workers * 2, max_threads) : workers + 1) {
+        ShardedTodoManager::Options options;
+        options.directory = directory;
+        options.max_resident = max<size_t>(1, list_count / 4);
+        options.journal.sync = false;
+        size_t resident;
+        atomic<bool> running{true};
+        atomic<uint64_t> operations{0};
+        {
+            ShardedTodoManager lists(options);
+            vector<thread> threads;
+            for (unsigned w = 0; w < workers; ++w) {
+                threads.emplace_back([&, w] {
+                    uint64_t local = 0;
+                    uint64_t state = 0x9E3779B97F4A7C15ull * (w + 1);
+                    while (running.load(memory_order_relaxed)) {
+                        state = state * 6364136223846793005ull + 1442695040888963407ull;
+                        double draw = static_cast<double>(state >> 11) * 0x1.0p-53;
+                        size_t pick = static_cast<size_t>(draw * draw * static_cast<double>(list_count));
+                        // Move to a list this thread owns
+                        pick = pick / workers * workers + w;
+                        string id = "user-" + to_string(pick < list_count ? pick : w % list_count);
+                        lists.with_list(id, [&](TodoListManager& list) {
+                            list.add_task(TaskBuilder("stress task").build());
+                            list.mark_completed("stress task");
+                            list.delete_task("stress task");
+                        });
+                        local += 3;
+                    }
+                    operations.fetch_add(local);
+                });
+            }
+            this_thread::sleep_for(chrono::duration<double>(seconds_per_step));
+            running = false;
+            for (auto& worker : threads) {
+                worker.join();
+            }
+            resident = lists.resident_count();
+        }
+        cout << setw(7) << workers << "  " << setw(11) << fixed << setprecision(0)
+             << operations.load() / seconds_per_step << "  " << setw(8) << resident << "\n";
+    }
+    filesystem::remove_all(directory);
+    return EXIT_SUCCESS;
+}
+
+// Strip blanks from both ends of a command line, and a trailing '\r'
+inline string_view trim_blanks(string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r')) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+// Split off the first blank-separated word of a trimmed line
+inline string_view next_word(string_view& text) {
+    size_t end = text.find_first_of(" \t");
+    string_view word = text.substr(0, end);
+    text = end == string_view::npos ? string_view() : trim_blanks(text.substr(end));
+    return word;
+}
+
+// Batch mode: one command per line, run in order against a manager.
+//   add YYYY MM DD <description>
+//   complete <description>
+//   delete <description>
+//   complete-before YYYY MM DD
+//   undo | redo | checkpoint
+//   view [all|completed|pending|overdue] [text|csv|jsonl]
+// Blank lines and lines starting with '#' are skipped. Malformed lines and
+// failed operations are reported to err with their line number and skipped.
+class ScriptRunner {
+public:
+    struct Totals {
+        size_t lines = 0;
+        size_t applied = 0;
+        size_t failed = 0;
+    };
+
+private:
+    TodoListManager& manager;
+    ostream& out;
+    ostream& err;
+    Totals totals;
+    TaskBuilder builder;
+
+    void report(string_view problem, string_view detail) {
+        ++totals.failed;
+        string message = "line " + to_string(totals.lines) + ": ";
+        message += problem;
+        message += detail;
+        message += '\n';
+        err.write(message.data(), static_cast<streamsize>(message.size()));
+    }
+
+    void run_line(string_view line) {
+        ++totals.lines;
+        line = trim_blanks(line);
+        if (line.empty() || line.front() == '#') {
+            return;
+        }
+        string_view command = next_word(line);
+        bool ok = true;
+        try {
+            if (command == "add" || command == "complete-before") {
+                int32_t due_day;
+                string_view date_text = line;
+                bool complete_before = command == "complete-before";
+                if (!parse_date(line, due_day) || (complete_before && !line.empty())) {
+                    report("invalid date: ", date_text);
+                    return;
+                }
+                if (complete_before) {
+                    manager.complete_matching(TaskFilter().due_before(due_day));
+                } else if (line.empty()) {
+                    report("missing description", "");
+                    return;
+                } else {
+                    manager.add_task(builder.reset(line).set_due_date(from_day_number(due_day)).build());
+                }
+            } else if (command == "complete") {
+                ok = manager.mark_completed(line);
+            } else if (command == "delete") {
+                ok = manager.delete_task(line);
+            } else if (command == "undo" && line.empty()) {
+                manager.undo();
+            } else if (command == "redo" && line.empty()) {
+                manager.redo();
+            } else if (command == "checkpoint" && line.empty()) {
+                manager.checkpoint();
+            } else if (command == "stats" && line.empty()) {
+                print_stats(manager.stats(), out);
+            } else if (command == "metrics" && line.empty()) {
+                write_metrics(out);
+            } else if (command == "view") {
+                string filter_option(next_word(line));
+                OutputFormat format = output_format_from_name(line.empty() ? "text" : string(next_word(line)));
+                manager.view_tasks(TaskFilter::from_option(filter_option.empty() ? "all" : filter_option), format, out);
+            } else {
+                report("unknown command: ", command);
+                return;
+            }
+        } catch (const exception& ex) {
+            report(ex.what(), "");
+            return;
+        }
+        if (ok) {
+            ++totals.applied;
+        } else {
+            report("no matching task: ", line);
+        }
+    }
+
+public:
+    ScriptRunner(TodoListManager& target, ostream& output, ostream& errors)
+        : manager(target), out(output), err(errors) {}
+
+    // Run every complete line in text and return the bytes consumed; a
+    // trailing partial line is left unless final is set
+    size_t run(string_view text, bool final) {
+        size_t start = 0;
+        while (start < text.size()) {
+            size_t end = text.find('\n', start);
+            if (end == string_view::npos) {
+                if (!final) {
+                    break;
+                }
+                end = text.size();
+            }
+            run_line(text.substr(start, end - start));
+            start = end + 1;
+        }
+        return min(start, text.size());
+    }
+
+    // Run a mapped command file
+    void run_file(const string& path) {
+        MappedFile file(path);
+        run(string_view(file.data(), file.size()), true);
+    }
+
+    // Run commands read from a stream in 1 MB blocks
+    void run_stream(istream& in) {
+        const size_t block_size = 1 << 20;
+        string pending;
+        vector<char> block(block_size);
+        while (in.read(block.data(), static_cast<streamsize>(block.size())) || in.gcount() > 0) {
+            pending.append(block.data(), static_cast<size_t>(in.gcount()));
+            pending.erase(0, run(pending, false));
+        }
+        run(pending, true);
+    }
+
+    const Totals& result() const {
+        return totals;
+    }
+};
+
+// --script [file|-]: run a command file (or stdin) against the saved task
+// list. The journal is written without per-operation fsync and the run ends
+// with a checkpoint, which makes the whole script durable at once.
+int run_script(const string& path) {
+    TodoListManager manager;
+    OperationJournal::Options options;
+    options.sync = false;
+    try {
+        manager.open_journal("todo_journal.log", "todo_snapshot.bin", options);
+    } catch (const exception& ex) {
+        cerr << ex.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    ScriptRunner runner(manager, cout, cerr);
+    try {
+        if (path == "-") {
+            runner.run_stream(cin);
+        } else {
+            runner.run_file(path);
+        }
+        manager.checkpoint();
+    } catch (const exception& ex) {
+        cerr << ex.what() << "\n";
+        Logger::flush();
+        return EXIT_FAILURE;
+    }
+    cout.flush();
+    Logger::flush();
+    const ScriptRunner::Totals& totals = runner.result();
+    cerr << totals.lines << " lines, " << totals.applied << " applied, " << totals.failed << " failed\n";
+    return totals.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#ifdef __linux__
+// Stream buffer appending to a string, so view_tasks and write_metrics can
+// format straight into a connection's output buffer
+class StringAppendBuffer : public streambuf {
+private:
+    string& target;
+
+protected:
+    int overflow(int c) override {
+        if (c != EOF) {
+            target += static_cast<char>(c);
+        }
+        return c;
+    }
+
+    streamsize xsputn(const char* data, streamsize count) override {
+        target.append(data, static_cast<size_t>(count));
+        return count;
+    }
+
+public:
+    explicit StringAppendBuffer(string& output) : target(output) {}
+};
+
+// Network front end for a set of lists, found by id through a resolver
+// (normally ShardedTodoManager::acquire). Clients speak the --script
+// command language over TCP, one command per line, plus "use <list id>" to
+// pick the list later lines apply to ("default" until then). Every command
+// line gets a reply, in order:
+//   OK [count] | ERR <reason>     changes, use, undo, redo, checkpoint
+//   <one summary line>            stats
+//   <lines...> END                view and metrics
+// Blank lines and '#' comments get no reply.
+//
+// "follow <sequence>" turns the connection into a change feed for its list:
+// the reply is "FEED <sequence>" and then the list's journal records after
+// that sequence, framed as in the journal file, forever. A follower too far
+// behind for the retained feed first gets "SNAPSHOT <bytes> <sequence>" and
+// a snapshot file of that size, then the feed from the snapshot onwards.
+//
+// Requests may be pipelined. Each read is parsed completely before any
+// reply is sent, and every run of add/complete/delete lines goes to the
+// list as one apply_pipelined call: one lock, one journal record and one
+// fsync, while undo still steps back one command at a time. Each reactor
+// thread owns an epoll loop and a SO_REUSEPORT listener, so the kernel
+// spreads new connections across reactors and a connection never changes
+// threads.
+class TodoServer {
+public:
+    struct Options {
+        string address = "127.0.0.1";
+        uint16_t port = 7070;                       // 0: any free port
+        size_t reactors = 0;                        // 0: one per hardware thread
+        size_t max_batch = 1024;                    // commands per apply_batch
+        size_t max_line = 64 * 1024;                // longer lines close the connection
+        size_t output_high_water = 1 << 20;         // stop reading past this much unsent output
+    };
+
+    using ListResolver = function<shared_ptr<TodoListManager>(const string& list_id)>;
+
+private:
+    struct Connection {
+        int fd = -1;
+        string input;
+        string output;
+        size_t sent = 0;
+        string list = "default";
+        uint32_t interest = 0;
+        bool peer_closed = false;
+        shared_ptr<TodoListManager> followed;       // set once the connection is a change feed
+        uint64_t follow_sequence = 0;
+        size_t subscription = 0;
+        uint64_t snapshot_ticket = 0;               // nonzero while its snapshot is being built
+        shared_ptr<const string> snapshot;          // image still being queued ahead of the feed
+        size_t snapshot_queued = 0;
+    };
+
+    // A follower's snapshot built on the shared pool
+    struct BuiltSnapshot {
+        int fd;
+        uint64_t ticket;
+        uint64_t sequence;
+        shared_ptr<const string> image;             // null if building failed
+        string error;
+    };
+
+    // Where pool jobs leave built snapshots for a reactor, which they may
+    // outlive; wake_fd is -1 once the reactor has gone
+    struct SnapshotMailbox {
+        mutex lock;
+        int wake_fd = -1;
+        vector<BuiltSnapshot> ready;
+    };
+
+    // One event loop thread: accepts on its own listener and serves the
+    // connections it accepted
+    class Reactor {
+    private:
+        TodoServer& server;
+        int listener;
+        int epoll_fd = -1;
+        int wake_fd = -1;                           // written when a followed list has new changes
+        unordered_map<int, unique_ptr<Connection>> connections;
+        vector<char> read_buffer;
+        vector<TaskCommand> batch;
+        unique_ptr<bool[]> outcomes;
+        shared_ptr<TodoListManager> manager;
+        shared_ptr<SnapshotMailbox> mailbox = make_shared<SnapshotMailbox>();
+        uint64_t last_ticket = 0;
+
+        void watch(int fd, uint32_t events, int op) {
+            epoll_event event{};
+            event.events = events;
+            event.data.fd = fd;
+            if (epoll_ctl(epoll_fd, op, fd, &event) != 0) {
+                throw TaskManagerException("epoll_ctl failed: " + string(strerror(errno)));
+            }
+        }
+
+        void accept_all() {
+            while (true) {
+                int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) {
+                    return;    // EAGAIN, or a connection that died before we got to it
+                }
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                auto connection = make_unique<Connection>();
+                connection->fd = fd;
+                connection->interest = EPOLLIN | EPOLLRDHUP;
+                watch(fd, connection->interest, EPOLL_CTL_ADD);
+                connections.emplace(fd, move(connection));
+            }
+        }
+
+        void close_connection(Connection& connection) {
+            int fd = connection.fd;
+            if (connection.followed) {
+                connection.followed->unsubscribe_changes(connection.subscription);
+            }
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            ::close(fd);
+            connections.erase(fd);
+        }
+
+        TodoListManager& list_of(Connection& connection) {
+            if (!manager) {
+                manager = server.resolve(connection.list);
+                if (!manager) {
+                    throw TaskManagerException("No such list: " + connection.list);
+                }
+            }
+            return *manager;
+        }
+
+        void reply(Connection& connection, string_view text) {
+            connection.output += text;
+        }
+
+        // Send the queued add/complete/delete lines as one batch
+        void flush_batch(Connection& connection) {
+            if (batch.empty()) {
+                return;
+            }
+            try {
+                list_of(connection).apply_pipelined(batch.data(), batch.size(), outcomes.get());
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    reply(connection, outcomes[i] ? "OK\n" : "ERR no matching task\n");
+                }
+            } catch (const exception& ex) {
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    reply(connection, "ERR ");
+                    reply(connection, ex.what());
+                    reply(connection, "\n");
+                }
+            }
+            batch.clear();
+        }
+
+        // Run any command that cannot join a batch
+        void run_command(Connection& connection, string_view command, string_view line) {
+            ostream out(nullptr);
+            StringAppendBuffer sink(connection.output);
+            out.rdbuf(&sink);
+            if (command == "use" && !line.empty()) {
+                connection.list = string(line);
+                manager.reset();
+                reply(connection, "OK\n");
+            } else if (command == "complete-before") {
+                int32_t due_day;
+                if (!parse_date(line, due_day) || !line.empty()) {
+                    reply(connection, "ERR invalid date\n");
+                    return;
+                }
+                out << "OK " << list_of(connection).complete_matching(TaskFilter().due_before(due_day)) << "\n";
+            } else if (command == "undo" && line.empty()) {
+                list_of(connection).undo();
+                reply(connection, "OK\n");
+            } else if (command == "redo" && line.empty()) {
+                list_of(connection).redo();
+                reply(connection, "OK\n");
+            } else if (command == "checkpoint" && line.empty()) {
+                list_of(connection).checkpoint();
+                reply(connection, "OK\n");
+            } else if (command == "stats" && line.empty()) {
+                print_stats(list_of(connection).stats(), out);
+            } else if (command == "view") {
+                string filter_option(next_word(line));
+                OutputFormat format = output_format_from_name(line.empty() ? "text" : string(next_word(line)));
+                list_of(connection).view_tasks(TaskFilter::from_option(filter_option.empty() ? "all" : filter_option),
+                    format, out);
+                reply(connection, "END\n");
+            } else if (command == "metrics" && line.empty()) {
+                write_metrics(out);
+                reply(connection, "END\n");
+            } else if (command == "follow") {
+                uint64_t sequence = 0;
+                string_view digits = next_word(line);
+                auto parsed = from_chars(digits.data(), digits.data() + digits.size(), sequence);
+                if (digits.empty() || parsed.ec != errc() || parsed.ptr != digits.data() + digits.size()
+                    || !line.empty()) {
+                    reply(connection, "ERR invalid sequence\n");
+                    return;
+                }
+                start_following(connection, sequence);
+            } else {
+                reply(connection, "ERR unknown command: ");
+                reply(connection, command);
+                reply(connection, "\n");
+            }
+        }
+
+        // Subscribe before looking at the feed, so no change slips between
+        // the catch-up below and the first wake. A follower the feed does
+        // not reach back to gets a snapshot first, built on the shared pool
+        // so this reactor keeps serving its other connections.
+        void start_following(Connection& connection, uint64_t sequence) {
+            TodoListManager& list = list_of(connection);
+            int wake = wake_fd;
+            size_t subscription = list.subscribe_changes([wake] {
+                uint64_t one = 1;
+                ssize_t ignored = ::write(wake, &one, sizeof(one));
+                (void)ignored;
+            });
+            string probe;
+            uint64_t last;
+            bool in_feed;
+            try {
+                in_feed = list.read_changes(sequence, probe, 1, last);
+            } catch (...) {
+                list.unsubscribe_changes(subscription);
+                throw;
+            }
+            if (in_feed) {
+                reply(connection, "FEED " + to_string(sequence) + "\n");
+            } else {
+                connection.snapshot_ticket = ++last_ticket;
+                build_snapshot(connection.fd, connection.snapshot_ticket, manager);
+            }
+            connection.followed = manager;
+            connection.follow_sequence = sequence;
+            connection.subscription = subscription;
+        }
+
+        void build_snapshot(int fd, uint64_t ticket, shared_ptr<TodoListManager> list) {
+            shared_ptr<SnapshotMailbox> box = mailbox;
+            ThreadPool::shared().submit([box, fd, ticket, list] {
+                BuiltSnapshot built{fd, ticket, 0, nullptr, string()};
+                try {
+                    auto image = make_shared<string>();
+                    built.sequence = list->snapshot_image(*image);
+                    built.image = move(image);
+                } catch (const exception& ex) {
+                    built.error = ex.what();
+                }
+                lock_guard<mutex> lock(box->lock);
+                if (box->wake_fd >= 0) {
+                    box->ready.push_back(move(built));
+                    uint64_t one = 1;
+                    ssize_t ignored = ::write(box->wake_fd, &one, sizeof(one));
+                    (void)ignored;
+                }
+            });
+        }
+
+        // Start streaming the snapshots the pool has finished, ahead of the
+        // feed of changes after them
+        void take_snapshots() {
+            vector<BuiltSnapshot> built;
+            {
+                lock_guard<mutex> lock(mailbox->lock);
+                built.swap(mailbox->ready);
+            }
+            for (BuiltSnapshot& snapshot : built) {
+                auto it = connections.find(snapshot.fd);
+                if (it == connections.end() || it->second->snapshot_ticket != snapshot.ticket) {
+                    continue;    // the follower went away meanwhile
+                }
+                Connection& connection = *it->second;
+                connection.snapshot_ticket = 0;
+                if (!snapshot.image) {
+                    reply(connection, "ERR " + snapshot.error + "\n");
+                    connection.followed->unsubscribe_changes(connection.subscription);
+                    connection.followed.reset();
+                    connection.peer_closed = true;
+                    flush_output(connection);
+                    continue;
+                }
+                reply(connection, "SNAPSHOT " + to_string(snapshot.image->size()) + " "
+                    + to_string(snapshot.sequence) + "\n");
+                connection.snapshot = move(snapshot.image);
+                connection.snapshot_queued = 0;
+                connection.follow_sequence = snapshot.sequence;
+            }
+        }
+
+        // Queue the rest of a follower's snapshot, then feed records, up to
+        // the output high-water mark. A follower the feed no longer reaches
+        // back to is sent what is already queued and then disconnected, to
+        // come back for a snapshot.
+        void pump(Connection& connection) {
+            if (connection.snapshot_ticket != 0) {
+                return;
+            }
+            if (connection.snapshot) {
+                const string& image = *connection.snapshot;
+                size_t unsent = connection.output.size() - connection.sent;
+                size_t room = unsent < server.options.output_high_water ? server.options.output_high_water - unsent : 0;
+                size_t take = min(room, image.size() - connection.snapshot_queued);
+                connection.output.append(image, connection.snapshot_queued, take);
+                connection.snapshot_queued += take;
+                if (connection.snapshot_queued < image.size()) {
+                    return;
+                }
+                connection.snapshot.reset();
+                reply(connection, "FEED " + to_string(connection.follow_sequence) + "\n");
+            }
+            while (connection.output.size() - connection.sent < server.options.output_high_water) {
+                uint64_t last;
+                if (!connection.followed->read_changes(connection.follow_sequence, connection.output,
+                        server.options.output_high_water, last)) {
+                    Logger::warn("Follower fell behind the change feed at sequence ", connection.follow_sequence);
+                    connection.followed->unsubscribe_changes(connection.subscription);
+                    connection.followed.reset();
+                    connection.peer_closed = true;
+                    return;
+                }
+                if (last == connection.follow_sequence) {
+                    return;
+                }
+                connection.follow_sequence = last;
+            }
+        }
+
+        // Handle every complete line received so far, batching where order
+        // allows, then drop the consumed input. Lines after a follow
+        // command are ignored.
+        void process(Connection& connection) {
+            size_t start = 0;
+            while (!connection.followed) {
+                size_t end = connection.input.find('\n', start);
+                if (end == string::npos) {
+                    break;
+                }
+                string_view line = trim_blanks(string_view(connection.input).substr(start, end - start));
+                start = end + 1;
+                if (line.empty() || line.front() == '#') {
+                    continue;
+                }
+                string_view command = next_word(line);
+                int32_t due_day = 0;
+                if (command == "add") {
+                    if (!parse_date(line, due_day) || line.empty()) {
+                        flush_batch(connection);
+                        reply(connection, "ERR invalid date or missing description\n");
+                        continue;
+                    }
+                    batch.push_back(TaskCommand{TaskCommand::Kind::Add, line, due_day});
+                } else if ((command == "complete" || command == "delete") && !line.empty()) {
+                    batch.push_back(command == "complete" ? TaskCommand::complete(line) : TaskCommand::remove(line));
+                } else {
+                    flush_batch(connection);
+                    try {
+                        run_command(connection, command, line);
+                    } catch (const exception& ex) {
+                        reply(connection, "ERR ");
+                        reply(connection, ex.what());
+                        reply(connection, "\n");
+                    }
+                }
+                if (batch.size() >= server.options.max_batch) {
+                    flush_batch(connection);
+                }
+            }
+            flush_batch(connection);
+            manager.reset();
+            connection.input.erase(0, connection.followed ? string::npos : start);
+        }
+
+        // Send as much queued output as the socket takes; false on error
+        bool send_output(Connection& connection) {
+            while (connection.sent < connection.output.size()) {
+                ssize_t written = send(connection.fd, connection.output.data() + connection.sent,
+                    connection.output.size() - connection.sent, MSG_NOSIGNAL);
+                if (written < 0) {
+                    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+                }
+                connection.sent += static_cast<size_t>(written);
+            }
+            connection.output.clear();
+            connection.sent = 0;
+            return true;
+        }
+
+        void handle(Connection& connection, uint32_t events) {
+            if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                ssize_t received = recv(connection.fd, read_buffer.data(), read_buffer.size(), 0);
+                if (received > 0) {
+                    connection.input.append(read_buffer.data(), static_cast<size_t>(received));
+                } else if (received == 0) {
+                    connection.peer_closed = true;
+                    if (!connection.input.empty()) {
+                        connection.input += '\n';
+                    }
+                } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    close_connection(connection);
+                    return;
+                }
+                process(connection);
+                if (connection.input.size() > server.options.max_line) {
+                    reply(connection, "ERR line too long\n");
+                    connection.peer_closed = true;
+                    connection.input.clear();
+                }
+            }
+            if (connection.followed && !connection.peer_closed) {
+                pump(connection);
+            }
+            flush_output(connection);
+        }
+
+        // Send what the socket takes, then watch for whatever the
+        // connection waits on next
+        void flush_output(Connection& connection) {
+            if (!send_output(connection)) {
+                close_connection(connection);
+                return;
+            }
+            size_t unsent = connection.output.size() - connection.sent;
+            if (connection.peer_closed && unsent == 0) {
+                close_connection(connection);
+                return;
+            }
+            uint32_t interest = 0;
+            if (!connection.peer_closed && unsent < server.options.output_high_water) {
+                interest |= EPOLLIN | EPOLLRDHUP;
+            }
+            if (unsent > 0 || connection.snapshot) {
+                interest |= EPOLLOUT;    // a snapshot still to queue is pumped as the socket drains
+            }
+            if (interest != connection.interest) {
+                connection.interest = interest;
+                watch(connection.fd, interest, EPOLL_CTL_MOD);
+            }
+        }
+
+    public:
+        Reactor(TodoServer& owner, int listen_fd)
+            : server(owner), listener(listen_fd), read_buffer(64 * 1024),
+              outcomes(new bool[max<size_t>(1, owner.options.max_batch)]) {
+            batch.reserve(owner.options.max_batch);
+        }
+
+        Reactor(const Reactor&) = delete;
+        Reactor& operator=(const Reactor&) = delete;
+
+        ~Reactor() {
+            {
+                lock_guard<mutex> lock(mailbox->lock);
+                mailbox->wake_fd = -1;
+            }
+            for (auto& entry : connections) {
+                if (entry.second->followed) {
+                    entry.second->followed->unsubscribe_changes(entry.second->subscription);
+                }
+                ::close(entry.first);
+            }
+            if (wake_fd >= 0) {
+                ::close(wake_fd);
+            }
+            if (epoll_fd >= 0) {
+                ::close(epoll_fd);
+            }
+        }
+
+        // Feed new changes and built snapshots to every following connection
+        void wake_followers() {
+            uint64_t count;
+            ssize_t ignored = ::read(wake_fd, &count, sizeof(count));
+            (void)ignored;
+            take_snapshots();
+            vector<int> followers;
+            for (auto& entry : connections) {
+                if (entry.second->followed) {
+                    followers.push_back(entry.first);
+                }
+            }
+            for (int fd : followers) {
+                Connection& connection = *connections[fd];
+                pump(connection);
+                flush_output(connection);
+            }
+        }
+
+        // Serve until the server's stop event fires
+        void run() {
+            epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            if (epoll_fd < 0) {
+                throw TaskManagerException("epoll_create1 failed: " + string(strerror(errno)));
+            }
+            wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (wake_fd < 0) {
+                throw TaskManagerException("eventfd failed: " + string(strerror(errno)));
+            }
+            {
+                lock_guard<mutex> lock(mailbox->lock);
+                mailbox->wake_fd = wake_fd;
+            }
+            watch(listener, EPOLLIN, EPOLL_CTL_ADD);
+            watch(server.stop_fd, EPOLLIN, EPOLL_CTL_ADD);
+            watch(wake_fd, EPOLLIN, EPOLL_CTL_ADD);
+            epoll_event events[256];
+            while (true) {
+                int ready = epoll_wait(epoll_fd, events, 256, -1);
+                if (ready < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw TaskManagerException("epoll_wait failed: " + string(strerror(errno)));
+                }
+                for (int i = 0; i < ready; ++i) {
+                    int fd = events[i].data.fd;
+                    if (fd == server.stop_fd) {
+                        return;
+                    }
+                    if (fd == listener) {
+                        accept_all();
+                        continue;
+                    }
+                    if (fd == wake_fd) {
+                        wake_followers();
+                        continue;
+                    }
+                    auto it = connections.find(fd);
+                    if (it != connections.end()) {
+                        handle(*it->second, events[i].events);
+                    }
+                }
+            }
+        }
+    };
+
+    Options options;
+    ListResolver resolve;
+    vector<int> listeners;
+    int stop_fd = -1;
+    uint16_t bound_port = 0;
+
+    int open_listener(uint16_t port) {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        if (inet_pton(AF_INET, options.address.c_str(), &address.sin_addr) != 1) {
+            throw TaskManagerException("Invalid listen address: " + options.address);
+        }
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            throw TaskManagerException("socket failed: " + string(strerror(errno)));
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+            string reason = strerror(errno);
+            ::close(fd);
+            throw TaskManagerException("Cannot listen on " + options.address + ":" + to_string(port) + ": " + reason);
+        }
+        return fd;
+    }
+
+    void close_all() {
+        for (int fd : listeners) {
+            ::close(fd);
+        }
+        listeners.clear();
+        if (stop_fd >= 0) {
+            ::close(stop_fd);
+            stop_fd = -1;
+        }
+    }
+
+public:
+    // Bind the listeners; serving starts with run(). resolver may return
+    // null for an unknown list and is called from every reactor thread.
+    TodoServer(const Options& serving, ListResolver resolver)
+        : options(serving), resolve(move(resolver)) {
+        if (options.reactors == 0) {
+            options.reactors = max(1u, thread::hardware_concurrency());
+        }
+        try {
+            stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (stop_fd < 0) {
+                throw TaskManagerException("eventfd failed: " + string(strerror(errno)));
+            }
+            listeners.push_back(open_listener(options.port));
+            sockaddr_in bound{};
+            socklen_t length = sizeof(bound);
+            getsockname(listeners.front(), reinterpret_cast<sockaddr*>(&bound), &length);
+            bound_port = ntohs(bound.sin_port);
+            while (listeners.size() < options.reactors) {
+                listeners.push_back(open_listener(bound_port));
+            }
+        } catch (...) {
+            close_all();
+            throw;
+        }
+    }
+
+    TodoServer(const TodoServer&) = delete;
+    TodoServer& operator=(const TodoServer&) = delete;
+
+    ~TodoServer() {
+        close_all();
+    }
+
+    uint16_t port() const {
+        return bound_port;
+    }
+
+    // Serve on one thread per reactor until stop() is called
+    void run() {
+        vector<unique_ptr<Reactor>> reactors;
+        for (int listener : listeners) {
+            reactors.emplace_back(new Reactor(*this, listener));
+        }
+        vector<thread> threads;
+        for (auto& reactor : reactors) {
+            threads.emplace_back([&reactor] {
+                try {
+                    reactor->run();
+                } catch (const exception& ex) {
+                    Logger::error("Reactor stopped: ", ex.what());
+                }
+            });
+        }
+        for (auto& worker : threads) {
+            worker.join();
+        }
+    }
+
+    // Make every reactor return; async-signal-safe
+    void stop() {
+        uint64_t one = 1;
+        ssize_t ignored = ::write(stop_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+};
+
+// Keeps a read-only replica of one list on a primary TodoServer: installs
+// the primary's snapshot when the replica is too far behind, then applies
+// the change feed as it arrives. Lost connections are retried from the
+// replica's current sequence; the replica is saved to snapshot_path on
+// stop and reloaded from it on start, so a restart resumes from there.
+class ReplicaFollower {
+public:
+    struct Options {
+        string host = "127.0.0.1";
+        uint16_t port = 7070;
+        string list = "default";
+        string snapshot_path;                       // empty: start empty, save nothing
+        chrono::milliseconds retry_delay{500};
+    };
+
+private:
+    shared_ptr<TodoListManager> replica;
+    Options options;
+    int stop_fd = -1;
+    atomic<bool> stopping{false};
+
+    int connect_to_primary() {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        int status = getaddrinfo(options.host.c_str(), to_string(options.port).c_str(), &hints, &found);
+        if (status != 0) {
+            throw TaskManagerException("Cannot resolve " + options.host + ": " + gai_strerror(status));
+        }
+        int fd = -1;
+        for (addrinfo* candidate = found; candidate && fd < 0; candidate = candidate->ai_next) {
+            fd = socket(candidate->ai_family, candidate->ai_socktype | SOCK_CLOEXEC, candidate->ai_protocol);
+            if (fd >= 0 && connect(fd, candidate->ai_addr, candidate->ai_addrlen) != 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(found);
+        if (fd < 0) {
+            throw TaskManagerException("Cannot connect to " + options.host + ":" + to_string(options.port));
         }
+        return fd;
     }
 
-private:
-    // Get the current time as a formatted string
-    static string getCurrentTime() {
-        time_t now = time(nullptr);
-        tm timeinfo = *localtime(&now);
-        char buffer[80];
-        strftime(buffer, sizeof(buffer), "[%Y-%m-%d %H:%M:%S]", &timeinfo);
-        return buffer;
+    // Append whatever the primary sends next to input; false once stopped
+    bool receive(int fd, string& input) {
+        pollfd watched[2] = {{fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+        while (poll(watched, 2, -1) < 0) {
+            if (errno != EINTR) {
+                throw TaskManagerException("poll failed: " + string(strerror(errno)));
+            }
+        }
+        if (watched[1].revents) {
+            return false;
+        }
+        char chunk[64 * 1024];
+        ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received == 0) {
+            throw TaskManagerException("Primary closed the connection");
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                return true;
+            }
+            throw TaskManagerException("recv failed: " + string(strerror(errno)));
+        }
+        input.append(chunk, static_cast<size_t>(received));
+        return true;
     }
-};
 
-// Custom Exception for TaskManager
-class TaskManagerException : public runtime_error {
-public:
-    TaskManagerException(const string& message) : runtime_error(message) {}
-};
+    // Take one reply line off the front of input; false once stopped
+    bool read_line(int fd, string& input, string& line) {
+        size_t end;
+        while ((end = input.find('\n')) == string::npos) {
+            if (input.size() > 4096) {
+                throw TaskManagerException("Bad reply from primary");
+            }
+            if (!receive(fd, input)) {
+                return false;
+            }
+        }
+        line.assign(input, 0, end);
+        input.erase(0, end + 1);
+        if (line.compare(0, 4, "ERR ") == 0) {
+            throw TaskManagerException("Primary refused: " + line.substr(4));
+        }
+        return true;
+    }
+
+    void install_snapshot(int fd, string& input, size_t bytes) {
+        while (input.size() < bytes) {
+            if (!receive(fd, input)) {
+                return;
+            }
+        }
+        string path = options.snapshot_path.empty()
+            ? (filesystem::temp_directory_path() / ("todo-replica-" + to_string(getpid()) + ".snapshot")).string()
+            : options.snapshot_path;
+        string temp_path = path + ".incoming";
+        {
+            ofstream file(temp_path, ios::binary | ios::trunc);
+            file.write(input.data(), static_cast<streamsize>(bytes));
+            if (!file.flush()) {
+                throw TaskManagerException("Cannot write " + temp_path);
+            }
+        }
+        input.erase(0, bytes);
+        replica->load_snapshot(temp_path);
+        filesystem::rename(temp_path, path);
+        if (options.snapshot_path.empty()) {
+            filesystem::remove(path);
+        }
+        Logger::info("Replica installed snapshot at sequence ", replica->sequence());
+    }
+
+    // One connection: handshake, optional snapshot, then the feed until
+    // stopped or the connection fails
+    void follow_once() {
+        int fd = connect_to_primary();
+        try {
+            string request = "use " + options.list + "\nfollow " + to_string(replica->sequence()) + "\n";
+            if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+                throw TaskManagerException("send failed: " + string(strerror(errno)));
+            }
+            string input;
+            string line;
+            if (!read_line(fd, input, line)) {
+                ::close(fd);
+                return;
+            }
+            while (!stopping && read_line(fd, input, line) && line.compare(0, 5, "FEED ") != 0) {
+                unsigned long long bytes = 0;
+                unsigned long long sequence = 0;
+                if (sscanf(line.c_str(), "SNAPSHOT %llu %llu", &bytes, &sequence) != 2) {
+                    throw TaskManagerException("Bad reply from primary: " + line);
+                }
+                install_snapshot(fd, input, static_cast<size_t>(bytes));
+            }
+            Logger::info("Replica following ", options.host, ":", options.port, " from sequence ", replica->sequence());
+            while (!stopping) {
+                size_t offset = 0;
+                JournalRecord record;
+                while (size_t record_size = OperationJournal::decode_record(
+                           input.data() + offset, input.size() - offset, record)) {
+                    replica->apply_replicated(record);
+                    offset += record_size;
+                }
+                input.erase(0, offset);
+                uint32_t body_length = 0;
+                if (input.size() >= OperationJournal::record_header_size) {
+                    memcpy(&body_length, input.data(), sizeof(body_length));
+                    if (OperationJournal::record_header_size + body_length <= input.size()) {
+                        throw TaskManagerException("Corrupt record in change feed");
+                    }
+                }
+                if (!receive(fd, input)) {
+                    break;
+                }
+            }
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+    }
 
-class TaskMemento {
 public:
-    string description;
-    bool completed;
-    tm due_date;
+    ReplicaFollower(shared_ptr<TodoListManager> list, const Options& following)
+        : replica(move(list)), options(following) {
+        stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (stop_fd < 0) {
+            throw TaskManagerException("eventfd failed: " + string(strerror(errno)));
+        }
+        replica->set_read_only(true);
+        if (!options.snapshot_path.empty() && filesystem::exists(options.snapshot_path)) {
+            replica->load_snapshot(options.snapshot_path);
+        }
+    }
 
-    TaskMemento(const string& desc, bool comp, const tm& date)
-        : description(desc), completed(comp), due_date(date) {}
+    ReplicaFollower(const ReplicaFollower&) = delete;
+    ReplicaFollower& operator=(const ReplicaFollower&) = delete;
+
+    ~ReplicaFollower() {
+        ::close(stop_fd);
+    }
+
+    // Follow the primary until stop(), then save the replica
+    void run() {
+        while (!stopping) {
+            try {
+                follow_once();
+            } catch (const exception& ex) {
+                Logger::warn("Replica of ", options.list, ": ", ex.what());
+                pollfd watched = {stop_fd, POLLIN, 0};
+                poll(&watched, 1, static_cast<int>(options.retry_delay.count()));
+            }
+        }
+        if (!options.snapshot_path.empty()) {
+            replica->save_snapshot(options.snapshot_path);
+        }
+    }
+
+    // Make run() return; async-signal-safe
+    void stop() {
+        stopping = true;
+        uint64_t one = 1;
+        ssize_t ignored = ::write(stop_fd, &one, sizeof(one));
+        (void)ignored;
+    }
 };
 
-class Task {
-public:
-    string description;
-    bool completed;
-    tm due_date;
+atomic<TodoServer*> signalled_server{nullptr};
+atomic<ReplicaFollower*> signalled_follower{nullptr};
 
-    Task(const string& desc) : description(desc), completed(false) {}
+extern "C" void stop_signalled_server(int) {
+    if (TodoServer* server = signalled_server.load()) {
+        server->stop();
+    }
+    if (ReplicaFollower* follower = signalled_follower.load()) {
+        follower->stop();
+    }
+}
+#endif
 
-    // Mark the task as completed
-    void mark_completed() {
-        completed = true;
+// --serve [port] [directory]: serve the lists under directory over TCP on
+// 127.0.0.1 until SIGINT or SIGTERM, then checkpoint every loaded list
+int run_server(uint16_t port, const string& directory) {
+#ifdef __linux__
+    try {
+        ShardedTodoManager::Options list_options;
+        list_options.directory = directory;
+        ShardedTodoManager lists(list_options);
+        TodoServer::Options options;
+        options.port = port;
+        TodoServer server(options, [&lists](const string& list_id) { return lists.acquire(list_id); });
+        signalled_server = &server;
+        signal(SIGINT, stop_signalled_server);
+        signal(SIGTERM, stop_signalled_server);
+        cerr << "Serving " << directory << " on " << options.address << ":" << server.port() << "\n";
+        Logger::info("Server listening on port ", server.port());
+        server.run();
+        signalled_server = nullptr;
+    } catch (const exception& ex) {
+        cerr << ex.what() << "\n";
+        Logger::flush();
+        return EXIT_FAILURE;
     }
+    Logger::flush();
+    return EXIT_SUCCESS;
+#else
+    (void)port;
+    (void)directory;
+    cerr << "--serve needs Linux (epoll)\n";
+    return EXIT_FAILURE;
+#endif
+}
 
-    // Undo the task to a previous state using a memento
-    void undo(const TaskMemento& memento) {
-        description = memento.description;
-        completed = memento.completed;
-        due_date = memento.due_date;
+// --follow host:port [list] [port]: replicate list from the primary server
+// at host:port and serve the replica read-only on 127.0.0.1:port until
+// SIGINT or SIGTERM. The replica is saved to <list>.replica.snapshot so a
+// restart resumes where it stopped.
+int run_follower(const string& primary, const string& list_id, uint16_t port) {
+#ifdef __linux__
+    try {
+        ReplicaFollower::Options follow_options;
+        size_t colon = primary.rfind(':');
+        follow_options.host = primary.substr(0, colon);
+        if (colon != string::npos) {
+            follow_options.port = static_cast<uint16_t>(stoul(primary.substr(colon + 1)));
+        }
+        follow_options.list = list_id;
+        follow_options.snapshot_path = list_id + ".replica.snapshot";
+        auto replica = make_shared<TodoListManager>();
+        ReplicaFollower follower(replica, follow_options);
+        TodoServer::Options options;
+        options.port = port;
+        TodoServer server(options, [&](const string& requested) {
+            return requested == list_id ? replica : shared_ptr<TodoListManager>();
+        });
+        signalled_server = &server;
+        signalled_follower = &follower;
+        signal(SIGINT, stop_signalled_server);
+        signal(SIGTERM, stop_signalled_server);
+        cerr << "Replicating " << list_id << " from " << primary << ", serving on "
+             << options.address << ":" << server.port() << "\n";
+        thread following([&follower] { follower.run(); });
+        server.run();
+        follower.stop();
+        following.join();
+        signalled_server = nullptr;
+        signalled_follower = nullptr;
+    } catch (const exception& ex) {
+        cerr << ex.what() << "\n";
+        Logger::flush();
+        return EXIT_FAILURE;
     }
+    Logger::flush();
+    return EXIT_SUCCESS;
+#else
+    (void)primary;
+    (void)list_id;
+    (void)port;
+    cerr << "--follow needs Linux (epoll)\n";
+    return EXIT_FAILURE;
+#endif
+}
 
-    // Create a memento representing the current state of the task
-    TaskMemento create_memento() const {
-        return TaskMemento(description, completed, due_date);
+// Peak resident set size of the process in kilobytes (0 if unavailable)
+inline size_t peak_rss_kb() {
+#ifndef _WIN32
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return 0;
+#endif
+}
+
+// Stream buffer that discards everything, for timing view_tasks output
+class NullBuffer : public streambuf {
+protected:
+    int overflow(int c) override {
+        return c;
     }
 
-    // Print the task details
-    void print() const {
-        string status = completed ? "Completed" : "Pending";
-        cout << description << " - " << status << ", Due: " << due_date.tm_year + 1900
-            << "-" << due_date.tm_mon + 1 << "-" << due_date.tm_mday << endl;
+    streamsize xsputn(const char*, streamsize count) override {
+        return count;
     }
 };
 
-class TaskBuilder {
-private:
-    shared_ptr<Task> task;
+// Run op(i) for up to max_ops iterations or until the time budget is spent,
+// then print ns/op, allocations/op and peak RSS. op returns how many units
+// of work it did (1 for a single call, N for a pass over N tasks).
+template <typename Operation>
+void run_benchmark(const string& name, size_t size, size_t max_ops, Operation&& op) {
+    const auto budget = chrono::milliseconds(500);
+    uint64_t allocations_before = allocation_count.load(memory_order_relaxed);
+    auto start = chrono::steady_clock::now();
+    size_t units = 0;
+    for (size_t i = 0; i < max_ops; ++i) {
+        units += op(i);
+        if (i % 64 == 63 && chrono::steady_clock::now() - start > budget) {
+            break;
+        }
+    }
+    double nanoseconds = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    uint64_t allocations = allocation_count.load(memory_order_relaxed) - allocations_before;
+    units = max<size_t>(units, 1);
+    cout << left << setw(26) << name << right << setw(10) << size << setw(11) << units
+         << setw(12) << fixed << setprecision(1) << nanoseconds / units << setw(12) << setprecision(2);
+    // Allocations are only counted when the metrics are compiled in
+    if (TODO_METRICS) {
+        cout << double(allocations) / units;
+    } else {
+        cout << "-";
+    }
+    cout << setw(12) << peak_rss_kb() / 1024 << "\n";
+}
 
-public:
-    // Initialize the task builder with a description
-    TaskBuilder(const string& desc) : task(make_shared<Task>(desc)) {}
+// Benchmark the TodoListManager hot paths and Logger::log on task lists of
+// 1k, 10k, ... up to max_size tasks
+int run_benchmarks(size_t max_size) {
+    Logger::Config log_config;
+    log_config.file_path = null_device();
+    Logger::configure(log_config);
 
-    // Set the due date for the task
-    TaskBuilder& set_due_date(const tm& date) {
-        task->due_date = date;
-        return *this;
+    cout << left << setw(26) << "benchmark" << right << setw(10) << "tasks" << setw(11) << "ops"
+         << setw(12) << "ns/op" << setw(12) << "allocs/op" << setw(12) << "peak MB" << "\n";
+    const size_t max_ops = 100000;
+    NullBuffer discard;
+
+    for (size_t size = 1000; size <= max_size; size *= 10) {
+        vector<string> names;
+        names.reserve(size);
+        for (size_t i = 0; i < size; ++i) {
+            names.push_back("task " + to_string(i));
+        }
+        TodoListManager manager;
+        {
+            vector<TaskCommand> commands;
+            commands.reserve(size + size / 3 + 1);
+            for (size_t i = 0; i < size; ++i) {
+                commands.push_back(TaskCommand::add(names[i], from_day_number(static_cast<int32_t>(19000 + i % 365))));
+            }
+            for (size_t i = 1; i < size; i += 3) {
+                commands.push_back(TaskCommand::complete(names[i]));
+            }
+            manager.apply_batch(commands);
+        }
+        // Distinct pseudo-random picks: 7919 is coprime with every power of ten
+        auto pick = [&](size_t i) -> const string& { return names[(i * 7919) % size]; };
+
+        for (const char* option : {"all", "completed", "pending"}) {
+            size_t shown = manager.count_tasks(TaskFilter::from_option(option));
+            run_benchmark(string("view_tasks(") + option + ") /task", size, max_ops, [&](size_t) {
+                streambuf* original = cout.rdbuf(&discard);
+                manager.view_tasks(option);
+                cout.rdbuf(original);
+                return shown;
+            });
+        }
+        for (const char* format : {"csv", "jsonl"}) {
+            ostream discarded(&discard);
+            OutputFormat output_format = output_format_from_name(format);
+            run_benchmark(string("view_tasks(all) ") + format + " /task", size, max_ops, [&](size_t) {
+                manager.view_tasks(TaskFilter(), output_format, discarded);
+                return size;
+            });
+        }
+        // Pending tasks in a due range: copy-then-remove_if as the list used
+        // to filter, then the bitset scan with each filter kernel
+        const int32_t first_day = 19100;
+        const int32_t last_day = 19200;
+        vector<TaskView> copied;
+        vector<uint32_t> selection;
+        run_benchmark("due range remove_if /task", size, max_ops, [&](size_t) {
+            copied.clear();
+            manager.for_each_task(TaskFilter(), [&copied](const TaskView& task) { copied.push_back(task); });
+            copied.erase(remove_if(copied.begin(), copied.end(), [&](const TaskView& task) {
+                return task.completed() || task.due_day() < first_day || task.due_day() > last_day;
+            }), copied.end());
+            return size;
+        });
+        TaskFilter due_range = TaskFilter().status(TaskFilter::Status::Pending).due_between(first_day, last_day);
+        DueRangeKernel best_kernel = due_range_mask;
+        for (DueRangeKernel kernel : {DueRangeKernel(due_range_mask_scalar), best_kernel}) {
+            due_range_mask = kernel;
+            const char* kernel_name = due_range_kernel_name(kernel);
+            run_benchmark(string("due range ") + kernel_name + " /task", size, max_ops, [&](size_t) {
+                selection.clear();
+                manager.select_tasks(due_range, selection);
+                return size;
+            });
+            run_benchmark(string("due count ") + kernel_name + " /task", size, max_ops, [&](size_t) {
+                manager.count_tasks(due_range);
+                return size;
+            });
+            if (kernel == best_kernel) {
+                break;
+            }
+        }
+        due_range_mask = best_kernel;
+
+        // The same scans split across the shared pool
+        for (size_t threads : {size_t(1), size_t(0)}) {
+            ParallelOptions options;
+            options.threads = threads;
+            options.serial_below = 0;
+            manager.set_parallelism(options);
+            const char* mode = threads == 1 ? "serial" : "parallel";
+            run_benchmark(string("select ") + mode + " /task", size, max_ops, [&](size_t) {
+                selection.clear();
+                manager.select_tasks(due_range, selection);
+                return size;
+            });
+            run_benchmark(string("count ") + mode + " /task", size, max_ops, [&](size_t) {
+                manager.count_tasks(due_range);
+                return size;
+            });
+        }
+        manager.set_parallelism(ParallelOptions());
+
+        run_benchmark("stats", size, max_ops, [&](size_t) {
+            manager.stats();
+            return 1;
+        });
+        run_benchmark("count_tasks(overdue)", size, max_ops, [&](size_t) {
+            manager.count_tasks(TaskFilter::from_option("overdue"));
+            return 1;
+        });
+
+        // Snapshots are slow enough per call to time a few of each
+        const string snapshot_path = (filesystem::temp_directory_path() / "todo_bench.snapshot").string();
+        for (SnapshotFormat format : {SnapshotFormat::Mapped, SnapshotFormat::Compressed}) {
+            const char* name = format == SnapshotFormat::Mapped ? "mapped" : "compressed";
+            manager.set_snapshot_format(format);
+            run_benchmark(string("save ") + name + " /task", size, 3, [&](size_t) {
+                manager.save_snapshot(snapshot_path);
+                return size;
+            });
+            TodoListManager loaded;
+            run_benchmark(string("load ") + name + " /task", size, 3, [&](size_t) {
+                loaded.load_snapshot(snapshot_path);
+                return size;
+            });
+            cout << "  " << name << " snapshot: " << filesystem::file_size(snapshot_path) / size << " bytes/task\n";
+        }
+        filesystem::remove(snapshot_path);
+        manager.set_snapshot_format(SnapshotFormat::Mapped);
+
+        run_benchmark("mark_completed", size, min(max_ops, size), [&](size_t i) {
+            manager.mark_completed(pick(i));
+            return 1;
+        });
+        run_benchmark("undo+redo", size, max_ops, [&](size_t) {
+            manager.undo();
+            manager.redo();
+            return 2;
+        });
+        run_benchmark("delete_task", size, min(max_ops, size), [&](size_t i) {
+            manager.delete_task(pick(i));
+            return 1;
+        });
+        TaskBuilder builder;
+        run_benchmark("add_task", size, max_ops, [&](size_t i) {
+            manager.add_task(builder.reset("added " + to_string(i)).build());
+            return 1;
+        });
+        run_benchmark("Logger::log", size, max_ops, [&](size_t) {
+            Logger::log("Task added: benchmark");
+            return 1;
+        });
+        run_benchmark("Logger::debug (filtered)", size, max_ops, [&](size_t i) {
+            Logger::debug("Task not found: ", pick(i), " after ", i, " tries");
+            return 1;
+        });
+        run_benchmark("ScopedTimer", size, max_ops, [&](size_t) {
+            ScopedTimer timer(Metrics::Op::Count);
+            return 1;
+        });
+        Logger::flush();
     }
+    return EXIT_SUCCESS;
+}
 
-    // Build and return the task
-    shared_ptr<Task> build() const {
-        return task;
+// Resident set size of the process right now in kilobytes (the peak where
+// the current size is unavailable)
+inline size_t current_rss_kb() {
+#ifdef __linux__
+    ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident = 0;
+    if (statm >> pages >> resident) {
+        return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE)) / 1024;
     }
+#endif
+    return peak_rss_kb();
+}
+
+// Shape of a synthetic workload: the operation mix as relative weights,
+// description lengths, how often an add repeats an earlier description,
+// and how due dates cluster
+struct WorkloadOptions {
+    double add_weight = 40;
+    double complete_weight = 20;
+    double delete_weight = 10;
+    double undo_weight = 5;
+    double redo_weight = 5;
+    double view_weight = 20;
+    size_t view_limit = 20;                 // a view shows the soonest-due pending tasks
+    size_t description_length = 24;         // mean; lengths are exponential around it
+    double duplicate_rate = 0.1;            // share of adds reusing a recent description
+    double due_skew = 1.0;                  // Zipf exponent over due-day offsets; 0 is uniform
+    int32_t due_span = 365;                 // due dates fall in [today, today + due_span)
 };
 
-class TodoListManager {
+// One generated operation; description views the generator's buffers and
+// stays valid until the next call
+struct WorkloadOp {
+    enum class Kind { Add, Complete, Delete, Undo, Redo, View, Count_ };
+
+    Kind kind;
+    string_view description;
+    int32_t due_day = 0;
+};
+
+// Seeded, so every run of a workload issues the same operations. Each
+// thread of a load test owns its own generator; complete and delete pick
+// among the descriptions this generator added recently, some of which are
+// already gone, as in real use.
+class WorkloadGenerator {
+public:
+    static constexpr size_t kind_count = static_cast<size_t>(WorkloadOp::Kind::Count_);
+
+    static const char* kind_name(WorkloadOp::Kind kind) {
+        static const char* const names[kind_count] = {"add", "complete", "delete", "undo", "redo", "view"};
+        return names[static_cast<size_t>(kind)];
+    }
+
 private:
-    vector<shared_ptr<Task>> tasks;
-    vector<TaskMemento> undo_stack;
-    vector<TaskMemento> redo_stack;
+    static constexpr size_t recent_capacity = 1 << 16;
+
+    WorkloadOptions options;
+    uint64_t state;
+    string prefix;
+    uint64_t added = 0;
+    array<double, kind_count> mix_cdf;
+    vector<double> due_cdf;
+    vector<string> recent;
+    string scratch;
+    int32_t today = today_day_number();
+
+    double uniform() {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return static_cast<double>(state >> 11) * 0x1.0p-53;
+    }
+
+    const string& pick_recent() {
+        return recent[static_cast<size_t>(uniform() * static_cast<double>(recent.size()))];
+    }
+
+    string_view new_description() {
+        static const char words[] = "buy milk call mom file taxes book flights review the quarterly report "
+                                    "renew passport water plants fix the leaking tap ";
+        double mean = static_cast<double>(max<size_t>(options.description_length, 1));
+        size_t length = static_cast<size_t>(-log(1.0 - uniform()) * mean) + 1;
+        length = min(length, 8 * static_cast<size_t>(mean));
+        scratch = prefix;
+        scratch += to_string(added++);
+        scratch += ' ';
+        size_t word = static_cast<size_t>(uniform() * (sizeof(words) - 1));
+        while (scratch.size() < length) {
+            scratch += words[word++ % (sizeof(words) - 1)];
+        }
+        if (recent.size() < recent_capacity) {
+            recent.push_back(scratch);
+        } else {
+            recent[static_cast<size_t>(uniform() * recent_capacity)] = scratch;
+        }
+        return scratch;
+    }
 
 public:
-    // Add a task to the task list
-    void add_task(const shared_ptr<Task>& task) {
-        tasks.push_back(task);
-        undo_stack.push_back(task->create_memento());
-        Logger::log("Task added: " + task->description);
+    WorkloadGenerator(const WorkloadOptions& workload, uint64_t seed, const string& description_prefix)
+        : options(workload), state(seed * 0x9E3779B97F4A7C15ull + 1), prefix(description_prefix) {
+        double weights[kind_count] = {options.add_weight, options.complete_weight, options.delete_weight,
+                                      options.undo_weight, options.redo_weight, options.view_weight};
+        double total = 0;
+        for (size_t kind = 0; kind < kind_count; ++kind) {
+            total += max(weights[kind], 0.0);
+            mix_cdf[kind] = total;
+        }
+        if (total <= 0) {
+            throw TaskManagerException("Workload mix has no operations");
+        }
+        for (double& bound : mix_cdf) {
+            bound /= total;
+        }
+        double due_total = 0;
+        for (int32_t offset = 0; offset < max(options.due_span, 1); ++offset) {
+            due_total += 1.0 / pow(offset + 1.0, options.due_skew);
+            due_cdf.push_back(due_total);
+        }
+        for (double& bound : due_cdf) {
+            bound /= due_total;
+        }
     }
 
-    // Mark a task as completed
-    bool mark_completed(const string& description) {
-        for (auto& task : tasks) {
-            if (task->description == description && !task->completed) {
-                task->mark_completed();
-                undo_stack.push_back(task->create_memento());
-                Logger::log("Task marked as completed: " + task->description);
-                return true;
-            }
+    // An add, whatever the mix says; for filling the list before a run
+    WorkloadOp next_add() {
+        WorkloadOp op{WorkloadOp::Kind::Add, {}, 0};
+        double offset = static_cast<double>(lower_bound(due_cdf.begin(), due_cdf.end(), uniform()) - due_cdf.begin());
+        op.due_day = today + static_cast<int32_t>(min(offset, static_cast<double>(due_cdf.size() - 1)));
+        if (!recent.empty() && uniform() < options.duplicate_rate) {
+            op.description = pick_recent();
+        } else {
+            op.description = new_description();
         }
-        Logger::log("Task not found or already completed: " + description);
-        return false;
+        return op;
     }
 
-    // Delete a task from the task list
-    bool delete_task(const string& description) {
-        for (auto& task : tasks) {
-            if (task->description == description) {
-                tasks.erase(remove(tasks.begin(), tasks.end(), task), tasks.end());
-                undo_stack.push_back(TaskMemento("", false, tm{}));
-                Logger::log("Task deleted: " + description);
-                return true;
+    WorkloadOp next() {
+        double draw = uniform();
+        auto kind = static_cast<WorkloadOp::Kind>(min<size_t>(
+            kind_count - 1, static_cast<size_t>(lower_bound(mix_cdf.begin(), mix_cdf.end(), draw) - mix_cdf.begin())));
+        if (kind == WorkloadOp::Kind::Add
+            || ((kind == WorkloadOp::Kind::Complete || kind == WorkloadOp::Kind::Delete) && recent.empty())) {
+            return next_add();
+        }
+        WorkloadOp op{kind, {}, 0};
+        if (kind == WorkloadOp::Kind::Complete || kind == WorkloadOp::Kind::Delete) {
+            op.description = pick_recent();
+        }
+        return op;
+    }
+};
+
+// What a load test runs: initial_tasks added up front, then each thread
+// count in turn for seconds, every thread issuing its own workload
+struct LoadTestOptions {
+    WorkloadOptions workload;
+    size_t initial_tasks = 100000;
+    vector<size_t> thread_counts = {1, 0};  // 0: one per hardware thread
+    double seconds = 5;
+    double report_interval = 1;             // seconds between progress lines
+    uint64_t seed = 1;
+};
+
+// A load test's results by name ("t4.ops_per_second", "t4.add.p99_us", ...)
+using LoadTestResults = map<string, double>;
+
+// Drive a fresh TodoListManager with the workload and print throughput,
+// memory growth over time and per-operation p50/p99/p999 latencies
+inline LoadTestResults run_load_test(const LoadTestOptions& test) {
+    LoadTestResults results;
+    vector<size_t> thread_counts;
+    for (size_t threads : test.thread_counts) {
+        threads = threads ? threads : max(1u, thread::hardware_concurrency());
+        if (find(thread_counts.begin(), thread_counts.end(), threads) == thread_counts.end()) {
+            thread_counts.push_back(threads);
+        }
+    }
+    const double tick_ns = CycleClock::nanoseconds_per_tick();
+    NullBuffer discard;
+    for (size_t thread_count : thread_counts) {
+        Logger::flush();
+        size_t rss_before = current_rss_kb();
+        TodoListManager manager;
+        {
+            WorkloadGenerator filler(test.workload, test.seed, "init ");
+            vector<string> descriptions;
+            vector<TaskCommand> commands;
+            descriptions.reserve(test.initial_tasks);
+            for (size_t i = 0; i < test.initial_tasks; ++i) {
+                WorkloadOp op = filler.next_add();
+                descriptions.emplace_back(op.description);
+                commands.push_back(TaskCommand{TaskCommand::Kind::Add, descriptions.back(), op.due_day});
             }
+            manager.apply_batch(commands);
+        }
+        size_t rss_start = current_rss_kb();
+
+        array<LatencyHistogram, WorkloadGenerator::kind_count> latencies;
+        atomic<bool> running{true};
+        atomic<uint64_t> operations{0};
+        vector<thread> workers;
+        for (size_t w = 0; w < thread_count; ++w) {
+            workers.emplace_back([&, w] {
+                WorkloadGenerator generator(test.workload, test.seed + 1 + w, "w" + to_string(w) + "-");
+                TaskBuilder builder;
+                ostream discarded(&discard);
+                uint64_t local = 0;
+                while (running.load(memory_order_relaxed)) {
+                    WorkloadOp op = generator.next();
+                    uint64_t start = CycleClock::now();
+                    switch (op.kind) {
+                        case WorkloadOp::Kind::Add:
+                            manager.add_task(builder.reset(op.description).set_due_date(from_day_number(op.due_day)).build());
+                            break;
+                        case WorkloadOp::Kind::Complete:
+                            manager.mark_completed(op.description);
+                            break;
+                        case WorkloadOp::Kind::Delete:
+                            manager.delete_task(op.description);
+                            break;
+                        case WorkloadOp::Kind::Undo:
+                            manager.undo();
+                            break;
+                        case WorkloadOp::Kind::Redo:
+                            manager.redo();
+                            break;
+                        case WorkloadOp::Kind::View:
+                        case WorkloadOp::Kind::Count_: {
+                            TaskWriter writer(discarded, OutputFormat::Text);
+                            manager.next_due(test.workload.view_limit,
+                                [&writer](const TaskView& task) { writer.write(task); });
+                            break;
+                        }
+                    }
+                    latencies[static_cast<size_t>(op.kind)].record(CycleClock::now() - start);
+                    if (++local % 64 == 0) {
+                        operations.fetch_add(64, memory_order_relaxed);
+                    }
+                }
+                operations.fetch_add(local % 64, memory_order_relaxed);
+            });
+        }
+
+        cout << "threads=" << thread_count << " initial_tasks=" << test.initial_tasks
+             << " rss=" << rss_start / 1024 << " MB (list " << (rss_start - min(rss_start, rss_before)) / 1024 << " MB)\n";
+        cout << "  elapsed      ops/s      tasks    rss MB\n";
+        auto started = chrono::steady_clock::now();
+        auto deadline = started + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(test.seconds));
+        uint64_t reported = 0;
+        auto last_report = started;
+        while (true) {
+            auto now = chrono::steady_clock::now();
+            auto next_report = last_report + chrono::duration_cast<chrono::steady_clock::duration>(
+                chrono::duration<double>(max(test.report_interval, 0.01)));
+            this_thread::sleep_until(min(next_report, deadline));
+            now = chrono::steady_clock::now();
+            uint64_t done = operations.load(memory_order_relaxed);
+            cout << setw(8) << fixed << setprecision(1) << chrono::duration<double>(now - started).count() << "s"
+                 << setw(11) << setprecision(0) << static_cast<double>(done - reported) / chrono::duration<double>(now - last_report).count()
+                 << setw(11) << manager.stats().total << setw(10) << current_rss_kb() / 1024 << "\n";
+            reported = done;
+            last_report = now;
+            if (now >= deadline) {
+                break;
+            }
+        }
+        running = false;
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        size_t rss_end = current_rss_kb();
+
+        string key = "t" + to_string(thread_count) + ".";
+        uint64_t total = operations.load();
+        results[key + "ops_per_second"] = static_cast<double>(total) / elapsed;
+        results[key + "rss_growth_mb"] = (static_cast<double>(rss_end) - static_cast<double>(rss_start)) / 1024;
+        cout << "  " << total << " ops, " << fixed << setprecision(0) << results[key + "ops_per_second"]
+             << " ops/s, rss " << rss_start / 1024 << " -> " << rss_end / 1024 << " MB\n";
+        cout << "  op              count      ops/s     p50 us     p99 us    p999 us     max us\n";
+        for (size_t kind = 0; kind < WorkloadGenerator::kind_count; ++kind) {
+            const LatencyHistogram& histogram = latencies[kind];
+            uint64_t count = histogram.count();
+            if (count == 0) {
+                continue;
+            }
+            string name = WorkloadGenerator::kind_name(static_cast<WorkloadOp::Kind>(kind));
+            auto micros = [&](uint64_t ticks) { return static_cast<double>(ticks) * tick_ns / 1000; };
+            results[key + name + ".p50_us"] = micros(histogram.quantile_ticks(0.5));
+            results[key + name + ".p99_us"] = micros(histogram.quantile_ticks(0.99));
+            results[key + name + ".p999_us"] = micros(histogram.quantile_ticks(0.999));
+            cout << "  " << left << setw(10) << name << right << setw(11) << count
+                 << setw(11) << setprecision(0) << static_cast<double>(count) / elapsed << setprecision(2)
+                 << setw(11) << results[key + name + ".p50_us"] << setw(11) << results[key + name + ".p99_us"]
+                 << setw(11) << results[key + name + ".p999_us"] << setw(11) << micros(histogram.max_ticks()) << "\n";
         }
-        Logger::log("Task not found: " + description);
-        return false;
     }
+    return results;
+}
 
-    // Undo the last operation
-    void undo() {
-        if (undo_stack.size() > 1) {
-            auto task_memento = undo_stack.back();
-            undo_stack.pop_back();
-            redo_stack.push_back(task_memento);
-            tasks.back()->undo(undo_stack.back());
-            Logger::log("Undo completed");
-        } else {
-            Logger::log("Undo not possible");
+// Save results as "name value" lines, the format check_load_baseline reads
+inline void save_load_baseline(const LoadTestResults& results, const string& path) {
+    ofstream out(path, ios::trunc);
+    out << setprecision(6);
+    for (const auto& result : results) {
+        out << result.first << " " << result.second << "\n";
+    }
+    if (!out.flush()) {
+        throw TaskManagerException("Cannot write " + path);
+    }
+}
+
+// Compare results with a saved baseline and print every regression past
+// tolerance: throughput below baseline * (1 - tolerance), p50 or p99 above
+// baseline * (1 + tolerance). p999 and memory growth are too noisy over a
+// short run to gate on, and results missing from either side are skipped.
+// Returns the number of regressions.
+inline size_t check_load_baseline(const LoadTestResults& results, const string& path, double tolerance) {
+    ifstream in(path);
+    if (!in) {
+        throw TaskManagerException("Cannot open baseline " + path);
+    }
+    size_t regressions = 0;
+    string name;
+    double expected;
+    while (in >> name >> expected) {
+        auto found = results.find(name);
+        if (found == results.end() || name.find("p999") != string::npos || name.find("rss") != string::npos) {
+            continue;
+        }
+        double actual = found->second;
+        bool higher_is_better = name.find("ops_per_second") != string::npos;
+        bool regressed = higher_is_better ? actual < expected * (1 - tolerance) : actual > expected * (1 + tolerance);
+        if (regressed) {
+            cout << "REGRESSION " << name << ": " << actual << " vs baseline " << expected << "\n";
+            ++regressions;
         }
     }
+    return regressions;
+}
 
-    // Redo the last undone operation
-    void redo() {
-        if (!redo_stack.empty()) {
-            auto task_memento = redo_stack.back();
-            redo_stack.pop_back();
-            undo_stack.push_back(task_memento);
-            if (task_memento.description.empty()) {
-                tasks.pop_back();
-                Logger::log("Redo completed (Task deleted)");
+// --load [key=value ...]: run a synthetic workload and report it. Keys:
+//   tasks, seconds, threads (comma-separated, 0 = all cores), seed,
+//   report (seconds between progress lines),
+//   add, complete, delete, undo, redo, view (mix weights), shown (tasks
+//   per view), length (mean description length), duplicates, skew, span,
+//   save=path (write the results as a baseline),
+//   baseline=path and tolerance (fail on a regression past it, default 0.2)
+int run_load(int argc, char* argv[]) {
+    Logger::Config log_config;
+    log_config.file_path = null_device();
+    Logger::configure(log_config);
+
+    LoadTestOptions test;
+    string save_path;
+    string baseline_path;
+    double tolerance = 0.2;
+    try {
+        for (int i = 0; i < argc; ++i) {
+            string argument = argv[i];
+            size_t equals = argument.find('=');
+            if (equals == string::npos) {
+                throw TaskManagerException("Expected key=value: " + argument);
+            }
+            string key = argument.substr(0, equals);
+            string value = argument.substr(equals + 1);
+            WorkloadOptions& workload = test.workload;
+            map<string, double*> weights = {
+                {"add", &workload.add_weight}, {"complete", &workload.complete_weight},
+                {"delete", &workload.delete_weight}, {"undo", &workload.undo_weight},
+                {"redo", &workload.redo_weight}, {"view", &workload.view_weight},
+                {"duplicates", &workload.duplicate_rate}, {"skew", &workload.due_skew},
+                {"seconds", &test.seconds}, {"report", &test.report_interval}, {"tolerance", &tolerance}};
+            if (weights.count(key)) {
+                *weights[key] = stod(value);
+            } else if (key == "tasks") {
+                test.initial_tasks = stoul(value);
+            } else if (key == "length") {
+                workload.description_length = stoul(value);
+            } else if (key == "shown") {
+                workload.view_limit = stoul(value);
+            } else if (key == "span") {
+                workload.due_span = stoi(value);
+            } else if (key == "seed") {
+                test.seed = stoull(value);
+            } else if (key == "threads") {
+                test.thread_counts.clear();
+                stringstream counts(value);
+                for (string count; getline(counts, count, ',');) {
+                    test.thread_counts.push_back(stoul(count));
+                }
+            } else if (key == "save") {
+                save_path = value;
+            } else if (key == "baseline") {
+                baseline_path = value;
             } else {
-                tasks.back()->undo(undo_stack.back());
-                Logger::log("Redo completed");
+                throw TaskManagerException("Unknown load test option: " + key);
             }
-        } else {
-            Logger::log("Redo not possible");
         }
+        LoadTestResults results = run_load_test(test);
+        if (!save_path.empty()) {
+            save_load_baseline(results, save_path);
+            cout << "Baseline saved to " << save_path << "\n";
+        }
+        if (!baseline_path.empty()) {
+            size_t regressions = check_load_baseline(results, baseline_path, tolerance);
+            cout << (regressions ? "FAIL: " : "OK: ") << regressions << " regressions against " << baseline_path << "\n";
+            return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+    } catch (const exception& ex) {
+        cerr << ex.what() << "\n";
+        return EXIT_FAILURE;
     }
+    return EXIT_SUCCESS;
+}
 
-    // View tasks based on a filter option (all, completed, pending)
-    void view_tasks(const string& filter_option = "all") const {
-        auto filtered_tasks = tasks;
-        if (filter_option == "completed") {
-            filtered_tasks.erase(
-                remove_if(filtered_tasks.begin(), filtered_tasks.end(),
-                    [](const shared_ptr<Task>& task) { return !task->completed; }),
-                filtered_tasks.end()
-            );
-        } else if (filter_option == "pending") {
-            filtered_tasks.erase(
-                remove_if(filtered_tasks.begin(), filtered_tasks.end(),
-                    [](const shared_ptr<Task>& task) { return task->completed; }),
-                filtered_tasks.end()
-            );
+// --selftest: check journal recovery, checkpoints, undo across compaction
+// and replication against scratch files under the temp directory. Prints
+// one line per check; fails if any check does.
+int run_selftest() {
+    Logger::Config log_config;
+    log_config.file_path = null_device();
+    Logger::configure(log_config);
+
+    const filesystem::path directory = filesystem::temp_directory_path() / "todo_selftest";
+    const string journal_path = (directory / "todo_journal.log").string();
+    const string snapshot_path = (directory / "todo_snapshot.bin").string();
+    OperationJournal::Options options;
+    options.sync = false;
+    const int32_t today = today_day_number();
+
+    auto add = [&](TodoListManager& manager, const string& description, int32_t due_offset) {
+        manager.add_task(TaskBuilder(description).set_due_date(from_day_number(today + due_offset)).build());
+    };
+    auto export_jsonl = [](const TodoListManager& manager) {
+        ostringstream out;
+        manager.view_tasks(TaskFilter::from_option("all"), OutputFormat::JsonLines, out);
+        return out.str();
+    };
+    // What --export jsonl prints for the saved files
+    auto export_saved = [&] {
+        TodoListManager exporter;
+        exporter.open_journal(journal_path, snapshot_path, options);
+        return export_jsonl(exporter);
+    };
+
+    size_t failures = 0;
+    auto check = [&](const char* name, const function<bool()>& test) {
+        bool passed = false;
+        string error;
+        try {
+            filesystem::remove_all(directory);
+            filesystem::create_directories(directory);
+            passed = test();
+        } catch (const exception& ex) {
+            error = ex.what();
+        }
+        cout << (passed ? "ok    " : "FAIL  ") << name;
+        if (!error.empty()) {
+            cout << ": " << error;
+        }
+        cout << "\n";
+        failures += passed ? 0 : 1;
+    };
+
+    check("torn journal tail is truncated", [&] {
+        string before_last;
+        uintmax_t intact;
+        {
+            TodoListManager manager;
+            manager.open_journal(journal_path, snapshot_path, options);
+            for (int i = 0; i < 100; ++i) {
+                add(manager, "task " + to_string(i), i % 40 - 10);
+            }
+            manager.mark_completed("task 7");
+            before_last = export_jsonl(manager);
+            intact = filesystem::file_size(journal_path);
+            manager.delete_task("task 8");
+        }
+        filesystem::resize_file(journal_path, filesystem::file_size(journal_path) - 3);
+        return export_saved() == before_last && filesystem::file_size(journal_path) == intact;
+    });
+
+    check("replay after a checkpoint matches the live list", [&] {
+        string live;
+        {
+            TodoListManager manager;
+            manager.open_journal(journal_path, snapshot_path, options);
+            for (int i = 0; i < 200; ++i) {
+                add(manager, "task " + to_string(i), i % 40 - 10);
+            }
+            for (int i = 0; i < 200; i += 3) {
+                manager.mark_completed("task " + to_string(i));
+            }
+            manager.delete_task("task 1");
+            manager.checkpoint();
+            // Undo and redo history from before the checkpoint
+            manager.undo();
+            manager.undo();
+            manager.redo();
+            vector<string> names;
+            for (int i = 0; i < 20; ++i) {
+                names.push_back("batch " + to_string(i));
+            }
+            vector<TaskCommand> commands;
+            for (const string& name : names) {
+                commands.push_back(TaskCommand::add(name, from_day_number(today)));
+            }
+            commands.push_back(TaskCommand::complete("task 2"));
+            commands.push_back(TaskCommand::remove("task 5"));
+            manager.apply_batch(commands);
+            manager.delete_task("task 10");
+            manager.undo();
+            live = export_jsonl(manager);
         }
+        return export_saved() == live;
+    });
 
-        for (const auto& task : filtered_tasks) {
-            task->print();
+    check("undo of deletes across compaction restores the list", [&] {
+        string original;
+        string restored;
+        {
+            TodoListManager manager;
+            manager.open_journal(journal_path, snapshot_path, options);
+            for (int i = 0; i < 4000; ++i) {
+                add(manager, "task " + to_string(i), i % 40 - 10);
+            }
+            original = export_jsonl(manager);
+            // Half the rows dead is past the compaction threshold
+            for (int i = 0; i < 4000; i += 2) {
+                manager.delete_task("task " + to_string(i));
+            }
+            for (int i = 0; i < 4000; i += 2) {
+                manager.undo();
+            }
+            restored = export_jsonl(manager);
+        }
+        return restored == original && export_saved() == original;
+    });
+
+    check("replication rejects a gap in sequence numbers", [&] {
+        TodoListManager replica;
+        JournalRecord record{1, JournalOp::Add, "replicated 1", today, false};
+        replica.apply_replicated(record);
+        // Already applied, so skipped
+        replica.apply_replicated(record);
+        record.sequence = 3;
+        record.description = "replicated 3";
+        bool rejected = false;
+        try {
+            replica.apply_replicated(record);
+        } catch (const TaskManagerException&) {
+            rejected = true;
+        }
+        record.sequence = 2;
+        record.description = "replicated 2";
+        replica.apply_replicated(record);
+        return rejected && replica.stats().total == 2;
+    });
+
+    check("a corrupt journal tail is dropped and the list keeps journaling", [&] {
+        string before_last;
+        {
+            TodoListManager manager;
+            manager.open_journal(journal_path, snapshot_path, options);
+            for (int i = 0; i < 50; ++i) {
+                add(manager, "task " + to_string(i), i % 40 - 10);
+            }
+            manager.mark_completed("task 3");
+            before_last = export_jsonl(manager);
+            add(manager, "task last", 0);
+        }
+        // Change a description byte so the last record's crc32 fails
+        {
+            fstream file(journal_path, ios::in | ios::out | ios::binary);
+            file.seekp(-2, ios::end);
+            file.put('#');
+        }
+        string recovered;
+        string live;
+        {
+            TodoListManager manager;
+            manager.open_journal(journal_path, snapshot_path, options);
+            recovered = export_jsonl(manager);
+            add(manager, "task after recovery", 1);
+            manager.delete_task("task 4");
+            live = export_jsonl(manager);
+        }
+        return recovered == before_last && export_saved() == live;
+    });
+
+    filesystem::remove_all(directory);
+    cout << (failures ? "FAIL: " : "OK: ") << failures << " failed checks\n";
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+    // Leading options, in any order, before the mode:
+    //   --metrics-file path: rewrite path with the Prometheus metrics every
+    //                        second while the rest of the command line runs
+    //   --log-level level:   log at level and above (default info)
+    unique_ptr<MetricsDumper> metrics_dumper;
+    while (argc > 2 && (string(argv[1]) == "--metrics-file" || string(argv[1]) == "--log-level")) {
+        try {
+            if (string(argv[1]) == "--metrics-file") {
+                metrics_dumper.reset(new MetricsDumper(argv[2], chrono::seconds(1)));
+            } else {
+                Logger::set_level(log_level_from_name(argv[2]));
+            }
+        } catch (const exception& ex) {
+            cerr << ex.what() << "\n";
+            return EXIT_FAILURE;
         }
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc > 1 && string(argv[1]) == "--stress") {
+        size_t task_count = argc > 2 ? stoul(argv[2]) : 1000000;
+        double seconds = argc > 3 ? stod(argv[3]) : 1.0;
+        return run_read_stress(task_count, seconds);
+    }
+    if (argc > 1 && string(argv[1]) == "--serve") {
+        return run_server(static_cast<uint16_t>(argc > 2 ? stoul(argv[2]) : 7070), argc > 3 ? argv[3] : "todo_lists");
+    }
+    if (argc > 1 && string(argv[1]) == "--follow" && argc > 2) {
+        return run_follower(argv[2], argc > 3 ? argv[3] : "default",
+            static_cast<uint16_t>(argc > 4 ? stoul(argv[4]) : 7071));
+    }
+    if (argc > 1 && string(argv[1]) == "--tenants") {
+        size_t list_count = argc > 2 ? stoul(argv[2]) : 10000;
+        double seconds = argc > 3 ? stod(argv[3]) : 1.0;
+        return run_tenant_stress(list_count, seconds);
+    }
+    if (argc > 1 && string(argv[1]) == "--load") {
+        return run_load(argc - 2, argv + 2);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        return run_benchmarks(argc > 2 ? stoul(argv[2]) : 1000000);
+    }
+    if (argc > 1 && string(argv[1]) == "--selftest") {
+        return run_selftest();
+    }
+    if (argc > 1 && string(argv[1]) == "--script") {
+        return run_script(argc > 2 ? argv[2] : "-");
+    }
+    // --export [filter] [text|csv|jsonl]: write the saved list to stdout
+    if (argc > 1 && string(argv[1]) == "--export") {
+        try {
+            OutputFormat format = output_format_from_name(argc > 3 ? argv[3] : "text");
+            TodoListManager exporter;
+            exporter.open_journal("todo_journal.log", "todo_snapshot.bin");
+            exporter.view_tasks(TaskFilter::from_option(argc > 2 ? argv[2] : "all"), format);
+            cout.flush();
+            Logger::flush();
+        } catch (const exception& ex) {
+            cerr << ex.what() << "\n";
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
     }
-};
 
-int main() {
+    const string snapshot_path = "todo_snapshot.bin";
+    const string journal_path = "todo_journal.log";
     TodoListManager todo_manager;
 
     try {
-        Logger::log("To-Do List Manager");
+        Logger::info("To-Do List Manager");
+        todo_manager.open_journal(journal_path, snapshot_path);
 
         while (true) {
             cout << "\nOptions:\n";
@@ -218,7 +7980,15 @@ int main() {
             cout << "Enter your choice: ";
 
             int choice;
-            cin >> choice;
+            if (!(cin >> choice)) {
+                if (cin.eof()) {
+                    choice = 7;
+                } else {
+                    cin.clear();
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    choice = 0;
+                }
+            }
 
             switch (choice) {
                 case 1: {
@@ -227,20 +7997,18 @@ int main() {
                     cin.ignore();
                     getline(cin, description);
 
-                    tm due_date = {};
                     string dateStr;
                     cout << "Enter due date (YYYY MM DD): ";
-                    cin >> dateStr;
-
-                    istringstream dateStream(dateStr);
-                    dateStream >> get_time(&due_date, "%Y %m %d");
+                    getline(cin, dateStr);
 
-                    if (dateStream.fail()) {
+                    string_view date_text = dateStr;
+                    int32_t due_day;
+                    if (!parse_date(date_text, due_day) || !date_text.empty()) {
                         throw TaskManagerException("Invalid date format");
                     }
 
-                    auto task = TaskBuilder(description).set_due_date(due_date).build();
-                    todo_manager.add_task(task);
+                    TaskBuilder builder(description);
+                    todo_manager.add_task(builder.set_due_date(from_day_number(due_day)).build());
 
                     cout << "Task added successfully!\n";
                     break;
@@ -273,11 +8041,45 @@ int main() {
                 }
                 case 4: {
                     string filter_option;
-                    cout << "Filter options: all, completed, pending\n";
+                    cout << "Filter options: all, completed, pending, overdue, due-before, due-between, next-due, search, stats\n";
                     cout << "Enter filter option: ";
                     cin >> filter_option;
 
-                    todo_manager.view_tasks(filter_option);
+                    auto read_day = [](const char* prompt) {
+                        int year, month, day;
+                        cout << prompt;
+                        if (!(cin >> year >> month >> day)) {
+                            throw TaskManagerException("Invalid date format");
+                        }
+                        return days_from_civil(year, month, day);
+                    };
+                    if (filter_option == "due-before") {
+                        int32_t day = read_day("Enter date (YYYY MM DD): ");
+                        todo_manager.view_tasks(TaskFilter().due_before(day));
+                    } else if (filter_option == "due-between") {
+                        int32_t first_day = read_day("Enter first date (YYYY MM DD): ");
+                        int32_t last_day = read_day("Enter last date (YYYY MM DD): ");
+                        todo_manager.view_tasks(TaskFilter().due_between(first_day, last_day));
+                    } else if (filter_option == "search") {
+                        string query;
+                        cout << "Enter search words (end a word with * to match a prefix): ";
+                        cin.ignore();
+                        getline(cin, query);
+                        if (todo_manager.search(query, [](const TaskView& task) { task.print(); }) == 0) {
+                            cout << "No matching tasks\n";
+                        }
+                    } else if (filter_option == "stats") {
+                        print_stats(todo_manager.stats());
+                    } else if (filter_option == "next-due") {
+                        size_t count;
+                        cout << "Enter number of tasks: ";
+                        if (!(cin >> count)) {
+                            throw TaskManagerException("Invalid number");
+                        }
+                        todo_manager.next_due(count, [](const TaskView& task) { task.print(); });
+                    } else {
+                        todo_manager.view_tasks(filter_option);
+                    }
                     break;
                 }
                 case 5:
@@ -288,6 +8090,8 @@ int main() {
                     break;
                 case 7:
                     cout << "Exiting...\n";
+                    todo_manager.checkpoint();
+                    Logger::flush();
                     return 0;
                 default:
                     cout << "Invalid choice! Please enter a valid option.\n";
@@ -296,7 +8100,8 @@ int main() {
         }
     } catch (const exception& ex) {
         cerr << "An exception occurred: " << ex.what() << endl;
-        Logger::log("An exception occurred: " + string(ex.what()));
+        Logger::error("An exception occurred: ", ex.what());
+        Logger::flush();
         return EXIT_FAILURE;
     }
 